@@ -1,559 +1,672 @@
-#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "postgres.h"
-#include "utils/jsonapi.h"
-#include "utils/builtins.h"
+#include "lib/stringinfo.h"
+#include "mb/pg_wchar.h"
+#include "miscadmin.h"
 
 #include "convert_to_msgpack.h"
-
-/*
- * Types for a scalar
- */
-typedef enum {
-	JSON_VALUE_SCALAR,
-	MSGPACK_BINARY
-} JsonValueType;
-
-typedef struct {
-	JsonTokenType	token_type;
-	char			*token;
-} JsonValueScalar;
-
-typedef struct {
-	size_t	size;
-	char	*data;
-} MsgpackBinary;
-
-typedef union {
-	JsonValueScalar	scalar;
-	MsgpackBinary	msg;
-} JsonValueUnion;
-
-typedef struct {
-	JsonValueType	type;
-	JsonValueUnion	via;
-} JsonValueData, *JsonValue;
-
-/*
- * Types for a container
- */
-typedef enum {
-	JSON_ARRAY,
-	JSON_OBJECT,
-	JSON_TOP_LEVEL
-} JsonContainerType;
-
-typedef struct _JsonObjectField {
-	struct _JsonObjectField	*next;
-	char					*key;
-	JsonValue				value;
-} JsonObjectFieldData, *JsonObjectField;
-
-typedef struct {
-	size_t			length;
-	JsonObjectField	start;
-	JsonObjectField	end;
-} JsonObject;
-
-typedef struct _JsonArrayElement {
-	struct _JsonArrayElement	*next;
-	JsonValue			value;
-} JsonArrayElementData, *JsonArrayElement;
-
-typedef struct {
-	size_t				length;
-	JsonArrayElement	start;
-	JsonArrayElement	end;
-} JsonArray;
-
-typedef struct {
-	JsonValue	value;
-} JsonTopLevel;
-
-typedef union {
-	JsonObject		object;
-	JsonArray		array;
-	JsonTopLevel	top_level;
-} JsonContainerUnion;
-
-typedef struct _JsonContainer{
-	struct _JsonContainer		*parent;
-	JsonContainerType			type;
-	JsonContainerUnion			via;
-} JsonContainerData, *JsonContainer;
+#include "scan_msgpack.h"
 
 /*
  * State for json_string_to_msgpack
+ *
+ * The parser reads the input in place and writes msgpack into out as it
+ * goes; nothing is allocated per token. str is a scratch buffer reused for
+ * strings with escapes.
  */
 typedef struct {
-	JsonLexContext	*lex;
-	JsonContainer	current_container;
-	msgpack_packer	*pk;
-	msgpack_sbuffer	*buf;
+	const char		*input;
+	const char		*p;
+	StringInfoData	out;
+	StringInfoData	str;
+	bool			utf8;
 } PackStateData, *PackState;
 
+/* width of the placeholder written for a container header */
+#define CONTAINER_HEADER_PLACEHOLDER 5
+
 /*
- * Semantic action functions for json_string_to_msgpack
+ * Bytes that end the fast path of a string: the quote, the backslash and
+ * control characters, including the terminating NUL
  */
-static void sem_object_start(void *state);
-static void sem_object_end(void *state);
-static void sem_array_start(void *state);
-static void sem_array_end(void *state);
-static void sem_object_field_start(void *state, char *fname, bool isnull);
-static void sem_array_element_start(void *state, bool isnull);
-static void sem_scalar(void *state, char *token, JsonTokenType tokentype);
+static const bool string_special[256] = {
+	true, true, true, true, true, true, true, true,
+	true, true, true, true, true, true, true, true,
+	true, true, true, true, true, true, true, true,
+	true, true, true, true, true, true, true, true,
+	['"'] = true,
+	['\\'] = true
+};
+
+/* powers of ten that a double holds exactly */
+static const double exact_powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+	1e21, 1e22
+};
 
 /*
- * Destroy function
+ * Parse functions
  */
-
-static inline void destroy_container(JsonContainer container);
-static inline void destroy_object(JsonObject object);
-static inline void destroy_array(JsonArray array);
-static inline void destroy_value(JsonValue value);
+static void parse_value(PackState state);
+static void parse_object(PackState state);
+static void parse_array(PackState state);
+static void parse_string(PackState state);
+static void parse_number(PackState state);
+static void parse_literal(PackState state, const char *literal, size_t len, char code);
+static void parse_escape(PackState state);
+static pg_wchar parse_hex4(PackState state);
 
 /*
  * Pack functions
  */
-static inline void pack_value(msgpack_packer *pk, const JsonValue value);
-static inline void pack_scalar(msgpack_packer *pk, const JsonValueScalar scalar);
-static inline void pack_string(msgpack_packer *pk, const char *str);
-static inline void pack_number(msgpack_packer *pk, const char *number_token);
-static inline void pack_unsigned_integer(msgpack_packer *pk, const char *unsigned_integer_token);
-static inline void pack_integer(msgpack_packer *pk, const char *integer_token);
-static inline void pack_real(msgpack_packer *pk, const char *real_token);
+static void finish_container(PackState state, int header, uint32 count, bool is_map);
+static inline void pack_raw(PackState state, const char *str, size_t len);
+static inline void pack_unsigned_integer(PackState state, uint64 value);
+static inline void pack_negative_integer(PackState state, int64 value);
+static inline void pack_double(PackState state, double value);
+static inline char * write_be(char *p, uint64 v, int nbytes);
 
 /*
  * Utility functions
  */
-static inline JsonValue value_to_be_set(const JsonContainer container);
+static inline void skip_whitespace(PackState state);
+static inline void expect_char(PackState state, char c, const char *expected);
+static void report_parse_error(PackState state, const char *expected) pg_attribute_noreturn();
 
-void
-json_string_to_msgpack(const char *json_str, msgpack_sbuffer *buf)
-{
-	PackState		state;
-	JsonLexContext	*lex = makeJsonLexContext(cstring_to_text(json_str), true);
-	JsonSemAction	*sem;
-	msgpack_packer	*pk;
-	JsonContainer	top_level;
-	JsonValue		top_level_value;
-
-	/* initialize packer */
-	pk = msgpack_packer_new(buf, msgpack_sbuffer_write);
-
-	/* initialize top level object */
-	top_level_value = palloc(sizeof(JsonValueData));
-
-	top_level = palloc(sizeof(JsonContainerData));
-	top_level->type = JSON_TOP_LEVEL;
-	top_level->parent = NULL;
-	top_level->via.top_level.value = top_level_value;
-
-	/* initialize state object */
-	state = palloc(sizeof(PackStateData));
-	state->lex = lex;
-	state->current_container = top_level;
-	state->pk = pk;
-	state->buf = buf;
-
-	/* initialize sem action */
-	sem = palloc(sizeof(JsonSemAction));
-	sem->semstate 				= (void *) state;
-	sem->object_start 			= sem_object_start;
-	sem->object_end 			= sem_object_end;
-	sem->array_start 			= sem_array_start;
-	sem->array_end 				= sem_array_end;
-	sem->object_field_start 	= sem_object_field_start;
-	sem->object_field_end 		= NULL;
-	sem->array_element_start 	= sem_array_element_start;
-	sem->array_element_end 		= NULL;
-	sem->scalar 				= sem_scalar;
-
-	/* run parser */
-	pg_parse_json(lex, sem);
-
-	/* pack top level value */
-	pack_value(pk, top_level_value);
-
-	/* destroy packer */
-	msgpack_packer_free(pk);
-
-	/* destroy top level object */
-	destroy_container(top_level);
-}
 
-static void
-sem_object_start(void *state)
+bytea *
+json_string_to_msgpack(const char *json_str)
 {
-	PackState		_state = (PackState) state;
-	JsonContainer	current_container, new_container;
+	PackStateData	state;
+	size_t			len = strlen(json_str);
+
+	state.input = json_str;
+	state.p = json_str;
+	state.utf8 = GetDatabaseEncoding() == PG_UTF8;
+
+	/* msgpack is usually smaller than its json, so this rarely grows */
+	initStringInfo(&state.out);
+	enlargeStringInfo(&state.out, VARHDRSZ + len + CONTAINER_HEADER_PLACEHOLDER);
+	state.out.len = VARHDRSZ;
+
+	initStringInfo(&state.str);
+
+	skip_whitespace(&state);
+	parse_value(&state);
+	skip_whitespace(&state);
+
+	if (*state.p != '\0')
+		report_parse_error(&state, "end of input");
 
-	current_container = _state->current_container;
+	pfree(state.str.data);
 
-	/* create and set new container */
-	new_container = palloc(sizeof(JsonContainerData));
-	new_container->type = JSON_OBJECT;
-	new_container->parent = current_container;
-	new_container->via.object.length = 0;
-	new_container->via.object.start = NULL;
-	new_container->via.object.end = NULL;
+	/* the buffer already has room for the varlena header */
+	SET_VARSIZE(state.out.data, state.out.len);
 
-	/* step forward to new container */
-	_state->current_container = new_container;
+	return (bytea *) state.out.data;
 }
 
+/*
+ * Parse functions
+ */
 static void
-sem_object_end(void *state)
+parse_value(PackState state)
 {
-	PackState		_state = (PackState) state;
-	msgpack_sbuffer	*buf;
-	JsonContainer	current_container, parent_container;
-	msgpack_packer 	*pk;
-	JsonObjectField	field;
-	size_t			packed_size;
-	char			*packed_data;
-	JsonValue		value;
-
-	current_container = _state->current_container;
-	pk = _state->pk;
-
-	/* start to pack map */
-	msgpack_pack_map(pk, current_container->via.object.length);
-
-	/* pack each field */
-	field = current_container->via.object.start;
-	while (field != NULL) {
-		/* pack key */
-		pack_string(pk, field->key);
-		/* pack value */
-		pack_value(pk, field->value);
-		/* next field*/
-		field = field->next;
-	}
+	check_stack_depth();
 
-	/* retrieve packed binary and reset buffer of packer */
-	buf = _state->buf;
-	packed_size = buf->size;
-	packed_data = msgpack_sbuffer_release(buf);
-
-	/* set packed binary to the last value of parent conationer */
-	parent_container = current_container->parent;
-	value = value_to_be_set(parent_container);
-	value->type = MSGPACK_BINARY;
-	value->via.msg.size = packed_size;
-	value->via.msg.data = packed_data;
-
-	/* step back to parent level */
-	_state->current_container = parent_container;
-	destroy_container(current_container);
+	switch (*state->p) {
+		case '{':
+			parse_object(state);
+			break;
+		case '[':
+			parse_array(state);
+			break;
+		case '"':
+			parse_string(state);
+			break;
+		case '-':
+		case '0': case '1': case '2': case '3': case '4':
+		case '5': case '6': case '7': case '8': case '9':
+			parse_number(state);
+			break;
+		case 't':
+			parse_literal(state, "true", 4, (char) 0xc3);
+			break;
+		case 'f':
+			parse_literal(state, "false", 5, (char) 0xc2);
+			break;
+		case 'n':
+			parse_literal(state, "null", 4, (char) 0xc0);
+			break;
+		default:
+			report_parse_error(state, "a value");
+	}
 }
 
 static void
-sem_array_start(void *state)
+parse_object(PackState state)
 {
-	PackState		_state = (PackState) state;
-	JsonContainer	current_container, new_container;
-
-	current_container = _state->current_container;
-
-	/* create and set new container */
-	new_container = palloc(sizeof(JsonContainerData));
-	new_container->type = JSON_ARRAY;
-	new_container->parent = current_container;
-	new_container->via.array.length = 0;
-	new_container->via.array.start = NULL;
-	new_container->via.array.end = NULL;
+	int		header = state->out.len;
+	uint32	count = 0;
+
+	/* the number of pairs is only known at the end */
+	state->p++;
+	enlargeStringInfo(&state->out, CONTAINER_HEADER_PLACEHOLDER);
+	state->out.len += CONTAINER_HEADER_PLACEHOLDER;
+
+	skip_whitespace(state);
+	if (*state->p != '}') {
+		for (;;) {
+			if (*state->p != '"')
+				report_parse_error(state, "a string key");
+			parse_string(state);
+
+			skip_whitespace(state);
+			expect_char(state, ':', "\":\"");
+			skip_whitespace(state);
+
+			parse_value(state);
+			count++;
+
+			skip_whitespace(state);
+			if (*state->p != ',')
+				break;
+			state->p++;
+			skip_whitespace(state);
+		}
+	}
+	expect_char(state, '}', "\",\" or \"}\"");
 
-	/* step forward to new container */
-	_state->current_container = new_container;
+	finish_container(state, header, count, true);
 }
 
 static void
-sem_array_end(void *state)
+parse_array(PackState state)
 {
-	PackState			_state = (PackState) state;
-	msgpack_sbuffer		*buf;
-	JsonContainer		current_container, parent_container;
-	msgpack_packer 		*pk;
-	JsonArrayElement	element;
-	size_t				packed_size;
-	char				*packed_data;
-	JsonValue			value;
-
-	current_container = _state->current_container;
-	pk = _state->pk;
-
-	/* start to pack array */
-	msgpack_pack_array(pk, current_container->via.array.length);
-
-	/* pack each element */
-	element = current_container->via.array.start;
-	while (element != NULL) {
-		/* pack value */
-		pack_value(pk, element->value);
-		/* next element */
-		element = element->next;
+	int		header = state->out.len;
+	uint32	count = 0;
+
+	state->p++;
+	enlargeStringInfo(&state->out, CONTAINER_HEADER_PLACEHOLDER);
+	state->out.len += CONTAINER_HEADER_PLACEHOLDER;
+
+	skip_whitespace(state);
+	if (*state->p != ']') {
+		for (;;) {
+			parse_value(state);
+			count++;
+
+			skip_whitespace(state);
+			if (*state->p != ',')
+				break;
+			state->p++;
+			skip_whitespace(state);
+		}
 	}
+	expect_char(state, ']', "\",\" or \"]\"");
 
-	/* retrieve packed binary and reset buffer of packer */
-	buf = _state->buf;
-	packed_size = buf->size;
-	packed_data = msgpack_sbuffer_release(buf);
-
-	/* set packed binary to the last value of parent conationer */
-	parent_container = current_container->parent;
-	value = value_to_be_set(parent_container);
-	value->type = MSGPACK_BINARY;
-	value->via.msg.size = packed_size;
-	value->via.msg.data = packed_data;
-
-	/* step back to parent level */
-	_state->current_container = parent_container;
-	destroy_container(current_container);
+	finish_container(state, header, count, false);
 }
 
 static void
-sem_object_field_start(void *state, char *fname, bool isnull)
+parse_string(PackState state)
 {
-	PackState		_state = (PackState) state;
-	JsonContainer	container;
-	JsonObjectField	new_field;
-	JsonValue		new_value;
+	const unsigned char	*p = (const unsigned char *) state->p + 1;
+	const unsigned char	*start = p;
 
-	container = _state->current_container;
+	while (!string_special[*p])
+		p++;
 
-	new_value = palloc(sizeof(JsonValueData));
+	/* without escapes the string is packed straight from the input */
+	if (*p == '"') {
+		pack_raw(state, (const char *) start, p - start);
+		state->p = (const char *) p + 1;
+		return;
+	}
 
-	new_field = palloc(sizeof(JsonObjectFieldData));
-	new_field->next = NULL;
-	new_field->key = pstrdup(fname);
-	new_field->value = new_value;
+	resetStringInfo(&state->str);
 
-	container->via.object.length += 1;
+	for (;;) {
+		appendBinaryStringInfo(&state->str, (const char *) start, p - start);
+		state->p = (const char *) p;
 
-	if (container->via.object.end == NULL) {
-		container->via.object.start = new_field;
-		container->via.object.end = new_field;
-	} else {
-		container->via.object.end->next = new_field;
-		container->via.object.end = new_field;
+		if (*p == '"')
+			break;
+		if (*p == '\0')
+			report_parse_error(state, "the end of a string");
+		if (*p != '\\')
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					 errmsg("invalid input syntax for type %s", "msgpack"),
+					 errdetail("Character with value 0x%02x must be escaped.", *p)));
+
+		parse_escape(state);
+
+		start = p = (const unsigned char *) state->p;
+		while (!string_special[*p])
+			p++;
 	}
+
+	pack_raw(state, state->str.data, state->str.len);
+	state->p++;
 }
 
 static void
-sem_array_element_start(void *state, bool isnull)
+parse_number(PackState state)
 {
-	PackState			_state = (PackState) state;
-	JsonContainer		container;
-	JsonArrayElement	new_element;
-	JsonValue			new_value;
+	const char	*p = state->p;
+	const char	*start = p;
+	bool		negative = false;
+	bool		overflow = false;
+	bool		integral = true;
+	uint64		mantissa = 0;
+	int			ndigits = 0;
+	int			exponent = 0;
+	int			exp_value = 0;
+	bool		exp_negative = false;
+	double		value;
+
+	if (*p == '-') {
+		negative = true;
+		p++;
+	}
 
-	container = _state->current_container;
+	/* integer part: a single zero or digits not starting with zero */
+	if (*p == '0') {
+		p++;
+	} else if (*p >= '1' && *p <= '9') {
+		while (*p >= '0' && *p <= '9') {
+			if (mantissa > (PG_UINT64_MAX - (*p - '0')) / 10)
+				overflow = true;
+			else
+				mantissa = mantissa * 10 + (*p - '0');
+			ndigits++;
+			p++;
+		}
+	} else {
+		state->p = p;
+		report_parse_error(state, "a digit");
+	}
 
-	new_value = palloc(sizeof(JsonValueData));
+	if (*p == '.') {
+		integral = false;
+		p++;
+		if (!(*p >= '0' && *p <= '9')) {
+			state->p = p;
+			report_parse_error(state, "a digit");
+		}
+		while (*p >= '0' && *p <= '9') {
+			if (ndigits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa != 0)
+					ndigits++;
+				exponent--;
+			}
+			p++;
+		}
+	}
 
-	new_element = palloc(sizeof(JsonArrayElementData));
-	new_element->next = NULL;
-	new_element->value = new_value;
+	if (*p == 'e' || *p == 'E') {
+		integral = false;
+		p++;
+		if (*p == '+' || *p == '-')
+			exp_negative = (*p++ == '-');
+		if (!(*p >= '0' && *p <= '9')) {
+			state->p = p;
+			report_parse_error(state, "a digit");
+		}
+		while (*p >= '0' && *p <= '9') {
+			if (exp_value < 10000)
+				exp_value = exp_value * 10 + (*p - '0');
+			p++;
+		}
+		exponent += exp_negative ? -exp_value : exp_value;
+	}
 
-	container->via.array.length += 1;
+	/* a number must not run into a word, as in "1true" */
+	if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+			(*p >= '0' && *p <= '9') || *p == '_') {
+		state->p = p;
+		report_parse_error(state, "a delimiter");
+	}
 
-	if (container->via.array.end == NULL) {
-		container->via.array.start = new_element;
-		container->via.array.end = new_element;
+	state->p = p;
+
+	if (integral && !overflow) {
+		if (!negative) {
+			pack_unsigned_integer(state, mantissa);
+			return;
+		}
+		if (mantissa <= (uint64) PG_INT64_MAX + 1) {
+			pack_negative_integer(state, (int64) (0 - mantissa));
+			return;
+		}
+	}
+
+	/*
+	 * A mantissa and power of ten that doubles hold exactly give the correctly
+	 * rounded value with a single operation; anything else goes to strtod.
+	 */
+	if (!overflow && ndigits <= 15 && exponent >= -22 && exponent <= 22) {
+		value = (double) mantissa;
+		if (exponent < 0)
+			value /= exact_powers_of_ten[-exponent];
+		else
+			value *= exact_powers_of_ten[exponent];
+		if (negative)
+			value = -value;
 	} else {
-		container->via.array.end->next = new_element;
-		container->via.array.end = new_element;
+		value = strtod(start, NULL);
 	}
+
+	pack_double(state, value);
 }
 
 static void
-sem_scalar(void *state, char *token, JsonTokenType tokentype)
+parse_literal(PackState state, const char *literal, size_t len, char code)
 {
-	PackState	_state = (PackState) state;
-	JsonContainer		container;
-	JsonValue			value;
-
-	container = _state->current_container;
-	value = value_to_be_set(container);
-	value->type = JSON_VALUE_SCALAR;
-	value->via.scalar.token_type = tokentype;
-	value->via.scalar.token = token;
-}
+	const char *p = state->p + len;
 
+	if (strncmp(state->p, literal, len) != 0 ||
+			(*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+			(*p >= '0' && *p <= '9') || *p == '_')
+		report_parse_error(state, "a value");
 
-static inline void
-destroy_container(JsonContainer container)
+	appendStringInfoChar(&state->out, code);
+	state->p = p;
+}
+
+/*
+ * Decode the escape at state->p into state->str
+ */
+static void
+parse_escape(PackState state)
 {
-	switch (container->type) {
-		case JSON_OBJECT:
-			destroy_object(container->via.object);
+	unsigned char	utf8[8];
+#if PG_VERSION_NUM >= 130000
+	char			converted[MAX_UNICODE_EQUIVALENT_STRING + 1];
+#endif
+	pg_wchar		c;
+	pg_wchar		low;
+
+	state->p++;
+
+	switch (*state->p) {
+		case '"':
+		case '\\':
+		case '/':
+			appendStringInfoChar(&state->str, *state->p);
+			break;
+		case 'b':
+			appendStringInfoChar(&state->str, '\b');
+			break;
+		case 'f':
+			appendStringInfoChar(&state->str, '\f');
+			break;
+		case 'n':
+			appendStringInfoChar(&state->str, '\n');
 			break;
-		case JSON_ARRAY:
-			destroy_array(container->via.array);
+		case 'r':
+			appendStringInfoChar(&state->str, '\r');
 			break;
-		case JSON_TOP_LEVEL:
-			destroy_value(container->via.top_level.value);
+		case 't':
+			appendStringInfoChar(&state->str, '\t');
 			break;
+		case 'u':
+			c = parse_hex4(state);
+
+			if (c >= 0xdc00 && c <= 0xdfff)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						 errmsg("invalid input syntax for type %s", "msgpack"),
+						 errdetail("Unicode low surrogate must follow a high surrogate.")));
+
+			/* a high surrogate must be followed by the escape of a low one */
+			if (c >= 0xd800 && c <= 0xdbff) {
+				if (state->p[1] != '\\' || state->p[2] != 'u')
+					ereport(ERROR,
+							(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+							 errmsg("invalid input syntax for type %s", "msgpack"),
+							 errdetail("Unicode low surrogate must follow a high surrogate.")));
+				state->p += 2;
+				low = parse_hex4(state);
+				if (low < 0xdc00 || low > 0xdfff)
+					ereport(ERROR,
+							(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+							 errmsg("invalid input syntax for type %s", "msgpack"),
+							 errdetail("Unicode low surrogate must follow a high surrogate.")));
+				c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+			}
+
+			if (c == 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_UNTRANSLATABLE_CHARACTER),
+						 errmsg("unsupported Unicode escape sequence"),
+						 errdetail("\\u0000 cannot be converted to text.")));
+
+			if (state->utf8) {
+				unicode_to_utf8(c, utf8);
+				appendBinaryStringInfo(&state->str, (const char *) utf8,
+						pg_utf_mblen(utf8));
+			} else if (c <= 0x7f) {
+				appendStringInfoChar(&state->str, (char) c);
+			} else {
+#if PG_VERSION_NUM >= 130000
+				/* as json input does, convert to the server encoding or fail */
+				pg_unicode_to_server(c, (unsigned char *) converted);
+				appendStringInfoString(&state->str, converted);
+#else
+				ereport(ERROR,
+						(errcode(ERRCODE_UNTRANSLATABLE_CHARACTER),
+						 errmsg("unsupported Unicode escape sequence"),
+						 errdetail("Unicode escape values cannot be used for code point values above 007F when the server encoding is not UTF8.")));
+#endif
+			}
+			break;
+		default:
+			report_parse_error(state, "a valid escape sequence");
 	}
-	pfree(container);
+
+	state->p++;
 }
 
-static inline void
-destroy_object(JsonObject object)
+/*
+ * Read the four hex digits of the \u escape at state->p, leaving state->p on
+ * the last digit
+ */
+static pg_wchar
+parse_hex4(PackState state)
 {
-	JsonObjectField	field;
-
-	field = object.start;
-	while (field != NULL) {
-		pfree(field->key);
-		destroy_value(field->value);
-		field = field->next;
+	pg_wchar	c = 0;
+	int			i;
+	char		h;
+
+	for (i = 1; i <= 4; ++i) {
+		h = state->p[i];
+
+		if (h >= '0' && h <= '9')
+			c = (c << 4) | (h - '0');
+		else if (h >= 'a' && h <= 'f')
+			c = (c << 4) | (h - 'a' + 10);
+		else if (h >= 'A' && h <= 'F')
+			c = (c << 4) | (h - 'A' + 10);
+		else
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					 errmsg("invalid input syntax for type %s", "msgpack"),
+					 errdetail("\"\\u\" must be followed by four hexadecimal digits.")));
 	}
+
+	state->p += 4;
+	return c;
 }
 
-static inline void
-destroy_array(JsonArray array)
+/*
+ * Pack functions
+ */
+
+/*
+ * Write the real header of a container over its placeholder and move the
+ * body back over the unused bytes
+ */
+static void
+finish_container(PackState state, int header, uint32 count, bool is_map)
 {
-	JsonArrayElement	element;
+	char	*p = state->out.data + header;
+	int		body = header + CONTAINER_HEADER_PLACEHOLDER;
+	int		width;
+
+	p = scan_msgpack_write_header(p, is_map ? SCAN_MSGPACK_MAP : SCAN_MSGPACK_ARRAY, count);
 
-	element = array.start;
-	while (element != NULL) {
-		destroy_value(element->value);
-		element = element->next;
+	width = p - (state->out.data + header);
+	if (width < CONTAINER_HEADER_PLACEHOLDER) {
+		memmove(p, state->out.data + body, state->out.len - body);
+		state->out.len -= CONTAINER_HEADER_PLACEHOLDER - width;
 	}
 }
 
 static inline void
-destroy_value(JsonValue value)
+pack_raw(PackState state, const char *str, size_t len)
 {
-	switch (value->type) {
-		case JSON_VALUE_SCALAR:
-			pfree(value->via.scalar.token);
-			break;
-		case MSGPACK_BINARY:
-			free(value->via.msg.data);
-			break;
-	}
-	pfree(value);
+	char *p;
+
+	enlargeStringInfo(&state->out, len + SCAN_MSGPACK_MAX_HEADER_SIZE);
+	p = state->out.data + state->out.len;
+
+	p = scan_msgpack_write_header(p, SCAN_MSGPACK_RAW, len);
+
+	memcpy(p, str, len);
+	state->out.len = (p + len) - state->out.data;
 }
 
 static inline void
-pack_value(msgpack_packer *pk, const JsonValue value)
+pack_unsigned_integer(PackState state, uint64 value)
 {
-	switch (value->type) {
-		case JSON_VALUE_SCALAR:
-			pack_scalar(pk, value->via.scalar);
-			break;
-		case MSGPACK_BINARY:
-			(* pk->callback)(pk->data, value->via.msg.data, value->via.msg.size);
-			break;
+	char *p;
+
+	enlargeStringInfo(&state->out, 9);
+	p = state->out.data + state->out.len;
+
+	if (value < 128) {
+		*p++ = (char) value;
+	} else if (value < 256) {
+		*p++ = (char) 0xcc;
+		p = write_be(p, value, 1);
+	} else if (value < 65536) {
+		*p++ = (char) 0xcd;
+		p = write_be(p, value, 2);
+	} else if (value <= PG_UINT32_MAX) {
+		*p++ = (char) 0xce;
+		p = write_be(p, value, 4);
+	} else {
+		*p++ = (char) 0xcf;
+		p = write_be(p, value, 8);
 	}
+
+	state->out.len = p - state->out.data;
 }
 
 static inline void
-pack_scalar(msgpack_packer *pk, const JsonValueScalar scalar)
+pack_negative_integer(PackState state, int64 value)
 {
-	switch (scalar.token_type) {
-		case JSON_TOKEN_STRING:
-			pack_string(pk, scalar.token);
-			break;
-		case JSON_TOKEN_NUMBER:
-			pack_number(pk, scalar.token);
-			break;
-		case JSON_TOKEN_TRUE:
-			msgpack_pack_true(pk);
-			break;
-		case JSON_TOKEN_FALSE:
-			msgpack_pack_false(pk);
-			break;
-		case JSON_TOKEN_NULL:
-			msgpack_pack_nil(pk);
-			break;
-		default:
-			/* TODO: parse error */
-			break;
+	char *p;
+
+	/* "-0" is a plain zero */
+	if (value == 0) {
+		pack_unsigned_integer(state, 0);
+		return;
 	}
-}
 
-static inline void
-pack_string(msgpack_packer *pk, const char *str)
-{
-	size_t len = strlen(str);
-	msgpack_pack_raw(pk, len);
-	msgpack_pack_raw_body(pk, str, len);
+	enlargeStringInfo(&state->out, 9);
+	p = state->out.data + state->out.len;
+
+	if (value >= -32) {
+		*p++ = (char) value;
+	} else if (value >= PG_INT8_MIN) {
+		*p++ = (char) 0xd0;
+		p = write_be(p, (uint64) value, 1);
+	} else if (value >= PG_INT16_MIN) {
+		*p++ = (char) 0xd1;
+		p = write_be(p, (uint64) value, 2);
+	} else if (value >= PG_INT32_MIN) {
+		*p++ = (char) 0xd2;
+		p = write_be(p, (uint64) value, 4);
+	} else {
+		*p++ = (char) 0xd3;
+		p = write_be(p, (uint64) value, 8);
+	}
+
+	state->out.len = p - state->out.data;
 }
 
 static inline void
-pack_number(msgpack_packer *pk, const char *number_token)
+pack_double(PackState state, double value)
 {
-	if (strchr(number_token, '.') == NULL) {
-		if (number_token[0] == '-')
-			pack_integer(pk, number_token);
-		else
-			pack_unsigned_integer(pk, number_token);
-	} else
-		pack_real(pk, number_token);
+	uint64	bits;
+	char	*p;
+
+	memcpy(&bits, &value, sizeof(bits));
+
+	enlargeStringInfo(&state->out, 9);
+	p = state->out.data + state->out.len;
+
+	*p++ = (char) 0xcb;
+	p = write_be(p, bits, 8);
+
+	state->out.len = p - state->out.data;
 }
 
-static inline void
-pack_unsigned_integer(msgpack_packer *pk, const char *uint_token)
+static inline char *
+write_be(char *p, uint64 v, int nbytes)
 {
-	char *end;
-	unsigned long value;
-	
-	errno = 0;
-	value = strtoul(uint_token, &end, 10);
-	/* TODO: error handling */
-
-	/* TODO */
-	msgpack_pack_unsigned_long(pk, value);
+	int i;
+
+	for (i = nbytes - 1; i >= 0; --i) {
+		p[i] = (char) (v & 0xff);
+		v >>= 8;
+	}
+
+	return p + nbytes;
 }
 
+/*
+ * Utility functions
+ */
 static inline void
-pack_integer(msgpack_packer *pk, const char *int_token)
+skip_whitespace(PackState state)
 {
-	char *end;
-	long value;
-	
-	errno = 0;
-	value = strtol(int_token, &end, 10);
-	/* TODO: error handling */
-
-	/* TODO */
-	msgpack_pack_long(pk, value);
+	const char *p = state->p;
+
+	while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+		p++;
+
+	state->p = p;
 }
 
 static inline void
-pack_real(msgpack_packer *pk, const char *real_token)
+expect_char(PackState state, char c, const char *expected)
 {
-	char *end;
-	double value;
+	if (*state->p != c)
+		report_parse_error(state, expected);
 
-	errno = 0;
-	value = strtod(real_token, &end);
-	/* TODO: error handling */
-
-	/* TODO */
-	msgpack_pack_double(pk, value);
+	state->p++;
 }
 
-static inline JsonValue
-value_to_be_set(const JsonContainer container)
+static void
+report_parse_error(PackState state, const char *expected)
 {
-	JsonValue value;
-	switch (container->type) {
-		case JSON_OBJECT:
-			value = container->via.object.end->value;
-			break;
-		case JSON_ARRAY:
-			value = container->via.array.end->value;
-			break;
-		case JSON_TOP_LEVEL:
-			value = container->via.top_level.value;
-			break;
-	}
-	return value;
-};
+	if (*state->p == '\0')
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid input syntax for type %s", "msgpack"),
+				 errdetail("The input string ended unexpectedly.")));
+
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+			 errmsg("invalid input syntax for type %s", "msgpack"),
+			 errdetail("Expected %s at offset %d.",
+				 expected, (int) (state->p - state->input))));
+}
@@ -1,12 +1,9 @@
 #ifndef __CONVERT_TO_MSGPACK__
-#define ___CONVERT_TO_MSGPACK__
+#define __CONVERT_TO_MSGPACK__
 
-/* TODO */
-/* stop to load stdbool.h. force to use postgresql's bool */
-#define _STDBOOL_H 
-#define __STDBOOL_H 
-#include <msgpack.h>
+#include "postgres.h"
 
-void json_string_to_msgpack(const char *json_str, msgpack_sbuffer *buf);
+/* Convert a json string to msgpack */
+bytea * json_string_to_msgpack(const char *json_str);
 
-#endif /* ___CONVERT_TO_MSGPACK__ */
+#endif /* __CONVERT_TO_MSGPACK__ */
@@ -0,0 +1,340 @@
+#include "postgres.h"
+#include "utils/memutils.h"
+
+#include "expanded_msgpack.h"
+#include "scan_msgpack.h"
+
+PG_FUNCTION_INFO_V1(msgpack_set);
+
+/*
+ * Expanded object methods
+ */
+static Size EM_get_flat_size(ExpandedObjectHeader *eohptr);
+static void EM_flatten_into(ExpandedObjectHeader *eohptr, void *result, Size allocated_size);
+
+static const ExpandedObjectMethods EM_methods = {
+	EM_get_flat_size,
+	EM_flatten_into
+};
+
+/*
+ * private functions
+ */
+static ExpandedMsgpackHeader * expand_msgpack(const char *start, const char *end,
+		MemoryContext parentcontext);
+static ExpandedMsgpackHeader * expand_msgpack_datum(Datum d, MemoryContext parentcontext);
+static void build_sorted_index(ExpandedMsgpackHeader *em);
+static int search_sorted_index(ExpandedMsgpackHeader *em, const char *key, uint32 keylen,
+		bool *found);
+static int entry_cmp(const void *a, const void *b, void *arg);
+static inline Size map_header_size(int n);
+
+
+bool
+datum_is_expanded_msgpack(Datum d)
+{
+	return VARATT_IS_EXTERNAL_EXPANDED(DatumGetPointer(d)) &&
+		((ExpandedMsgpackHeader *) DatumGetEOHP(d))->em_magic == EM_MAGIC;
+}
+
+ExpandedMsgpackHeader *
+DatumGetExpandedMsgpack(Datum d)
+{
+	ExpandedMsgpackHeader *em = (ExpandedMsgpackHeader *) DatumGetEOHP(d);
+
+	Assert(em->em_magic == EM_MAGIC);
+	return em;
+}
+
+bool
+expanded_msgpack_lookup(ExpandedMsgpackHeader *em, const char *key, uint32 keylen,
+		const char **val, uint32 *vallen)
+{
+	ExpandedMsgpackEntry	*entry;
+	bool					found;
+	int						pos;
+
+	if (em->sorted == NULL)
+		build_sorted_index(em);
+
+	pos = search_sorted_index(em, key, keylen, &found);
+	if (!found)
+		return false;
+
+	entry = &em->entries[em->sorted[pos]];
+	*val = entry->val;
+	*vallen = entry->vallen;
+	return true;
+}
+
+Datum
+msgpack_set(PG_FUNCTION_ARGS)
+{
+	ExpandedMsgpackHeader	*em;
+	ExpandedMsgpackEntry	*entry;
+	text					*key = PG_GETARG_TEXT_PP(1);
+	bytea					*value = PG_GETARG_BYTEA_P(2);
+	const char				*keystr = VARDATA_ANY(key);
+	uint32					keylen = VARSIZE_ANY_EXHDR(key);
+	uint32					vallen = VARSIZE(value) - VARHDRSZ;
+	MemoryContext			oldcontext;
+	bool					found;
+	int						pos;
+	char					*p;
+
+	/*
+	 * A read-write expanded input belongs to us and is changed in place;
+	 * anything else is expanded into a new object first.
+	 */
+	if (VARATT_IS_EXTERNAL_EXPANDED_RW(PG_GETARG_POINTER(0)) &&
+			datum_is_expanded_msgpack(PG_GETARG_DATUM(0)))
+		em = DatumGetExpandedMsgpack(PG_GETARG_DATUM(0));
+	else
+		em = expand_msgpack_datum(PG_GETARG_DATUM(0), CurrentMemoryContext);
+
+	if (em->sorted == NULL)
+		build_sorted_index(em);
+
+	oldcontext = MemoryContextSwitchTo(em->hdr.eoh_context);
+
+	pos = search_sorted_index(em, keystr, keylen, &found);
+
+	if (found) {
+		entry = &em->entries[em->sorted[pos]];
+		em->data_size -= entry->vallen;
+
+		/*
+		 * A value set before is a chunk of its own and is freed here, so that
+		 * setting the same key in a loop does not grow the object. Values in
+		 * the source copy go away with the object only.
+		 */
+		if (entry->val < em->flat || entry->val >= em->flat_end)
+			pfree((char *) entry->val);
+	} else {
+		if (em->nentries == em->maxentries) {
+			em->maxentries *= 2;
+			em->entries = repalloc(em->entries,
+					sizeof(ExpandedMsgpackEntry) * em->maxentries);
+			em->sorted = repalloc(em->sorted, sizeof(int) * em->maxentries);
+		}
+
+		entry = &em->entries[em->nentries];
+
+		/* encode the key as the packer would */
+		p = palloc(keylen + SCAN_MSGPACK_MAX_HEADER_SIZE);
+		entry->key = p;
+		p = scan_msgpack_write_header(p, SCAN_MSGPACK_RAW, keylen);
+		memcpy(p, keystr, keylen);
+		entry->raw = p;
+		entry->rawlen = keylen;
+		entry->keylen = (p + keylen) - entry->key;
+		em->data_size += entry->keylen;
+
+		/* the new entry goes after every entry with a smaller or equal key */
+		memmove(em->sorted + pos + 1, em->sorted + pos,
+				sizeof(int) * (em->nsorted - pos));
+		em->sorted[pos] = em->nentries;
+		em->nsorted++;
+		em->nentries++;
+	}
+
+	p = palloc(vallen);
+	memcpy(p, VARDATA(value), vallen);
+	entry->val = p;
+	entry->vallen = vallen;
+	em->data_size += vallen;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_RETURN_DATUM(EOHPGetRWDatum(&em->hdr));
+}
+
+/*
+ * Expanded object methods
+ */
+static Size
+EM_get_flat_size(ExpandedObjectHeader *eohptr)
+{
+	ExpandedMsgpackHeader *em = (ExpandedMsgpackHeader *) eohptr;
+
+	Assert(em->em_magic == EM_MAGIC);
+
+	return VARHDRSZ + map_header_size(em->nentries) + em->data_size;
+}
+
+static void
+EM_flatten_into(ExpandedObjectHeader *eohptr, void *result, Size allocated_size)
+{
+	ExpandedMsgpackHeader	*em = (ExpandedMsgpackHeader *) eohptr;
+	bytea					*out = (bytea *) result;
+	char					*p = VARDATA(out);
+	int						n = em->nentries;
+	int						i;
+
+	Assert(em->em_magic == EM_MAGIC);
+	Assert(allocated_size == EM_get_flat_size(eohptr));
+
+	SET_VARSIZE(out, allocated_size);
+
+	p = scan_msgpack_write_header(p, SCAN_MSGPACK_MAP, n);
+
+	for (i = 0; i < n; ++i) {
+		memcpy(p, em->entries[i].key, em->entries[i].keylen);
+		p += em->entries[i].keylen;
+		memcpy(p, em->entries[i].val, em->entries[i].vallen);
+		p += em->entries[i].vallen;
+	}
+}
+
+/*
+ * private functions
+ */
+static ExpandedMsgpackHeader *
+expand_msgpack(const char *start, const char *end, MemoryContext parentcontext)
+{
+	ExpandedMsgpackHeader	*em;
+	ExpandedMsgpackEntry	*entry;
+	ScanMsgpackHeaderData	map;
+	ScanMsgpackHeaderData	k;
+	MemoryContext			objcxt;
+	MemoryContext			oldcontext;
+	char					*flat;
+	const char				*p;
+	const char				*v;
+	uint32					i;
+
+	if (!scan_msgpack_header(start, end, &map) || map.type != SCAN_MSGPACK_MAP)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("cannot set a key in a msgpack value that is not a map")));
+
+	objcxt = AllocSetContextCreate(parentcontext,
+			"expanded msgpack",
+			ALLOCSET_START_SMALL_SIZES);
+
+	em = (ExpandedMsgpackHeader *) MemoryContextAlloc(objcxt, sizeof(ExpandedMsgpackHeader));
+	EOH_init_header(&em->hdr, &EM_methods, objcxt);
+	em->em_magic = EM_MAGIC;
+
+	oldcontext = MemoryContextSwitchTo(objcxt);
+
+	/* entries point into a private copy of the source */
+	flat = palloc(end - start);
+	memcpy(flat, start, end - start);
+	end = flat + (end - start);
+	p = flat + (map.body - start);
+	em->flat = flat;
+	em->flat_end = end;
+
+	em->nentries = map.size;
+	em->maxentries = Max(map.size, 8);
+	em->entries = palloc(sizeof(ExpandedMsgpackEntry) * em->maxentries);
+	em->sorted = NULL;
+	em->nsorted = 0;
+	em->data_size = 0;
+
+	for (i = 0; i < map.size; ++i) {
+		entry = &em->entries[i];
+
+		if (!scan_msgpack_header(p, end, &k) ||
+				(v = scan_msgpack_skip(p, end)) == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid msgpack value")));
+
+		entry->key = p;
+		entry->keylen = v - p;
+		entry->raw = k.type == SCAN_MSGPACK_RAW ? k.body : NULL;
+		entry->rawlen = k.type == SCAN_MSGPACK_RAW ? k.size : 0;
+
+		if ((p = scan_msgpack_skip(v, end)) == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid msgpack value")));
+
+		entry->val = v;
+		entry->vallen = p - v;
+		em->data_size += entry->keylen + entry->vallen;
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return em;
+}
+
+static ExpandedMsgpackHeader *
+expand_msgpack_datum(Datum d, MemoryContext parentcontext)
+{
+	bytea *data = DatumGetByteaP(d);
+
+	/* a read-only expanded input is flattened by the detoast above */
+	return expand_msgpack(VARDATA(data), VARDATA(data) + VARSIZE(data) - VARHDRSZ,
+			parentcontext);
+}
+
+static void
+build_sorted_index(ExpandedMsgpackHeader *em)
+{
+	int i;
+
+	em->sorted = MemoryContextAlloc(em->hdr.eoh_context, sizeof(int) * em->maxentries);
+	em->nsorted = 0;
+
+	for (i = 0; i < em->nentries; ++i) {
+		if (em->entries[i].raw != NULL)
+			em->sorted[em->nsorted++] = i;
+	}
+
+	/* ties are broken by position so that the first duplicate is found */
+	qsort_arg(em->sorted, em->nsorted, sizeof(int), entry_cmp, em);
+}
+
+static int
+search_sorted_index(ExpandedMsgpackHeader *em, const char *key, uint32 keylen, bool *found)
+{
+	ExpandedMsgpackEntry	*entry;
+	int						lo = 0;
+	int						hi = em->nsorted;
+	int						mid;
+
+	/* find the first entry not less than the key */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		entry = &em->entries[em->sorted[mid]];
+
+		if (scan_msgpack_raw_cmp(entry->raw, entry->rawlen, key, keylen) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*found = false;
+	if (lo < em->nsorted) {
+		entry = &em->entries[em->sorted[lo]];
+		*found = scan_msgpack_raw_cmp(entry->raw, entry->rawlen, key, keylen) == 0;
+	}
+
+	return lo;
+}
+
+static int
+entry_cmp(const void *a, const void *b, void *arg)
+{
+	ExpandedMsgpackHeader	*em = (ExpandedMsgpackHeader *) arg;
+	int						ia = *(const int *) a;
+	int						ib = *(const int *) b;
+	int						cmp;
+
+	cmp = scan_msgpack_raw_cmp(em->entries[ia].raw, em->entries[ia].rawlen,
+			em->entries[ib].raw, em->entries[ib].rawlen);
+	if (cmp != 0)
+		return cmp;
+
+	return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+static inline Size
+map_header_size(int n)
+{
+	return n < 16 ? 1 : (n < 65536 ? 3 : 5);
+}
@@ -0,0 +1,70 @@
+#ifndef __EXPANDED_MSGPACK_H__
+#define __EXPANDED_MSGPACK_H__
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "utils/expandeddatum.h"
+
+/*
+ * Expanded representation of a msgpack map.
+ *
+ * The map is split into entries that point at the encoded bytes of each key
+ * and value, with an index sorted by key for lookups. Setting a key only
+ * touches its entry; the map is encoded again when the value is flattened
+ * for storage. Values that are not maps are never expanded.
+ */
+
+#define EM_MAGIC 0x4d534750		/* "MSGP" */
+
+typedef struct {
+	/* encoded key, including its header */
+	const char	*key;
+	uint32		keylen;
+	/* payload of a raw key; NULL for keys of other types */
+	const char	*raw;
+	uint32		rawlen;
+	/* encoded value */
+	const char	*val;
+	uint32		vallen;
+} ExpandedMsgpackEntry;
+
+typedef struct {
+	ExpandedObjectHeader	hdr;
+
+	int						em_magic;
+
+	int						nentries;
+	int						maxentries;
+	ExpandedMsgpackEntry	*entries;
+
+	/*
+	 * entry numbers of raw keys ordered by key then position; NULL until
+	 * the first lookup
+	 */
+	int						*sorted;
+	int						nsorted;
+
+	/* total length of encoded keys and values */
+	Size					data_size;
+
+	/*
+	 * private copy of the source map. Keys and values point into it until
+	 * they are set; set ones are separate chunks owned by the entry.
+	 */
+	const char				*flat;
+	const char				*flat_end;
+} ExpandedMsgpackHeader;
+
+/* Whether the datum is a pointer to an expanded msgpack, read-only or not */
+bool datum_is_expanded_msgpack(Datum d);
+
+/* Return the expanded msgpack of a datum for which the above holds */
+ExpandedMsgpackHeader * DatumGetExpandedMsgpack(Datum d);
+
+/* Find the value of the first entry with a raw key. Returns false if not found */
+bool expanded_msgpack_lookup(ExpandedMsgpackHeader *em, const char *key, uint32 keylen,
+		const char **val, uint32 *vallen);
+
+Datum msgpack_set(PG_FUNCTION_ARGS);
+
+#endif /* __EXPANDED_MSGPACK_H__ */
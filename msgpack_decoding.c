@@ -0,0 +1,494 @@
+#include <msgpack.h>
+
+#include "postgres.h"
+#include "access/htup_details.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
+#include "nodes/bitmapset.h"
+#include "replication/logical.h"
+#include "replication/output_plugin.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/relcache.h"
+
+#include "msgpack_decoding.h"
+#include "pg_msgpack.h"
+
+/*
+ * Logical decoding output plugin emitting one msgpack map per change:
+ *
+ *   {"op":"B", "xid":...}                                 begin
+ *   {"op":"I"|"U"|"D", "relation":"schema.table",
+ *    "new":{column:value, ...}, "old":{key column:value, ...}}
+ *   {"op":"C", "xid":..., "lsn":...}                      commit
+ *
+ * "new" is present for inserts and updates, "old" for deletes and for
+ * updates that changed the replica identity. Use the plugin by the name of
+ * this library, with pg_logical_slot_get_binary_changes.
+ */
+
+/*
+ * Per relation metadata, kept until the relcache entry is invalidated
+ */
+typedef struct {
+	Oid			relid;		/* hash key; must be first */
+	bool		valid;
+	char		*relname;	/* qualified and quoted */
+	int			natts;
+	char		**attnames;	/* NULL for dropped columns */
+	Oid			*atttypids;
+	bool		*is_msgpack;
+	FmgrInfo	*out_functions;
+	bool		*typisvarlena;
+	Bitmapset	*identity;	/* replica identity columns; NULL if FULL */
+} RelationEntryData, *RelationEntry;
+
+/*
+ * Plugin state
+ */
+typedef struct {
+	/* reset after each change */
+	MemoryContext	context;
+} MsgpackDecodingData;
+
+/*
+ * Output plugin callbacks
+ */
+static void msgpack_decode_startup(LogicalDecodingContext *ctx,
+		OutputPluginOptions *opt, bool is_init);
+static void msgpack_decode_shutdown(LogicalDecodingContext *ctx);
+static void msgpack_decode_begin_txn(LogicalDecodingContext *ctx,
+		ReorderBufferTXN *txn);
+static void msgpack_decode_commit_txn(LogicalDecodingContext *ctx,
+		ReorderBufferTXN *txn, XLogRecPtr commit_lsn);
+static void msgpack_decode_change(LogicalDecodingContext *ctx,
+		ReorderBufferTXN *txn, Relation relation, ReorderBufferChange *change);
+
+/*
+ * Relation cache
+ */
+static RelationEntry get_relation_entry(Relation relation);
+static void build_relation_entry(RelationEntry entry, Relation relation);
+static void free_relation_entry(RelationEntry entry);
+static void invalidate_relation_entry(Datum arg, Oid relid);
+
+/*
+ * Pack functions
+ */
+static int write_to_output(void *data, const char *buf, unsigned int len);
+static inline void pack_cstring(msgpack_packer *pk, const char *str);
+static void pack_tuple(msgpack_packer *pk, RelationEntry entry, TupleDesc tupdesc,
+		HeapTuple tuple, Bitmapset *columns);
+static void pack_datum(msgpack_packer *pk, RelationEntry entry, int attidx, Datum value);
+
+static HTAB				*relation_cache = NULL;
+static MemoryContext	relation_cache_context = NULL;
+
+void
+_PG_output_plugin_init(OutputPluginCallbacks *cb)
+{
+	AssertVariableIsOfType(&_PG_output_plugin_init, LogicalOutputPluginInit);
+
+	cb->startup_cb = msgpack_decode_startup;
+	cb->begin_cb = msgpack_decode_begin_txn;
+	cb->change_cb = msgpack_decode_change;
+	cb->commit_cb = msgpack_decode_commit_txn;
+	cb->shutdown_cb = msgpack_decode_shutdown;
+}
+
+/*
+ * Output plugin callbacks
+ */
+static void
+msgpack_decode_startup(LogicalDecodingContext *ctx, OutputPluginOptions *opt,
+		bool is_init)
+{
+	MsgpackDecodingData	*data;
+	ListCell			*option;
+	HASHCTL				hash_ctl;
+	static bool			callback_registered = false;
+
+	foreach(option, ctx->output_plugin_options) {
+		DefElem *elem = (DefElem *) lfirst(option);
+
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("option \"%s\" is unknown", elem->defname)));
+	}
+
+	data = palloc0(sizeof(MsgpackDecodingData));
+	data->context = AllocSetContextCreate(ctx->context,
+			"msgpack decoding context",
+			ALLOCSET_DEFAULT_SIZES);
+
+	ctx->output_plugin_private = data;
+	opt->output_type = OUTPUT_PLUGIN_BINARY_OUTPUT;
+
+	if (relation_cache == NULL) {
+		relation_cache_context = AllocSetContextCreate(CacheMemoryContext,
+				"msgpack decoding relation cache",
+				ALLOCSET_DEFAULT_SIZES);
+
+		MemSet(&hash_ctl, 0, sizeof(hash_ctl));
+		hash_ctl.keysize = sizeof(Oid);
+		hash_ctl.entrysize = sizeof(RelationEntryData);
+		hash_ctl.hcxt = relation_cache_context;
+		relation_cache = hash_create("msgpack decoding relation cache",
+				128,
+				&hash_ctl,
+				HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	/* relcache callbacks cannot be unregistered, so register only once */
+	if (!callback_registered) {
+		CacheRegisterRelcacheCallback(invalidate_relation_entry, (Datum) 0);
+		callback_registered = true;
+	}
+}
+
+static void
+msgpack_decode_shutdown(LogicalDecodingContext *ctx)
+{
+	MsgpackDecodingData *data = ctx->output_plugin_private;
+
+	MemoryContextDelete(data->context);
+
+	if (relation_cache != NULL) {
+		hash_destroy(relation_cache);
+		relation_cache = NULL;
+		MemoryContextDelete(relation_cache_context);
+		relation_cache_context = NULL;
+	}
+}
+
+static void
+msgpack_decode_begin_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
+{
+	msgpack_packer	pk;
+
+	OutputPluginPrepareWrite(ctx, true);
+	msgpack_packer_init(&pk, ctx->out, write_to_output);
+
+	msgpack_pack_map(&pk, 2);
+	pack_cstring(&pk, "op");
+	pack_cstring(&pk, "B");
+	pack_cstring(&pk, "xid");
+	msgpack_pack_uint32(&pk, txn->xid);
+
+	OutputPluginWrite(ctx, true);
+}
+
+static void
+msgpack_decode_commit_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+		XLogRecPtr commit_lsn)
+{
+	msgpack_packer	pk;
+
+	OutputPluginPrepareWrite(ctx, true);
+	msgpack_packer_init(&pk, ctx->out, write_to_output);
+
+	msgpack_pack_map(&pk, 3);
+	pack_cstring(&pk, "op");
+	pack_cstring(&pk, "C");
+	pack_cstring(&pk, "xid");
+	msgpack_pack_uint32(&pk, txn->xid);
+	pack_cstring(&pk, "lsn");
+	msgpack_pack_uint64(&pk, commit_lsn);
+
+	OutputPluginWrite(ctx, true);
+}
+
+static void
+msgpack_decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+		Relation relation, ReorderBufferChange *change)
+{
+	MsgpackDecodingData		*data = ctx->output_plugin_private;
+	TupleDesc				tupdesc = RelationGetDescr(relation);
+	RelationEntry			entry;
+	ReorderBufferTupleBuf	*newtuple = NULL;
+	ReorderBufferTupleBuf	*oldtuple = NULL;
+	MemoryContext			old;
+	msgpack_packer			pk;
+	const char				*op;
+
+	switch (change->action) {
+		case REORDER_BUFFER_CHANGE_INSERT:
+			op = "I";
+			newtuple = change->data.tp.newtuple;
+			break;
+		case REORDER_BUFFER_CHANGE_UPDATE:
+			op = "U";
+			newtuple = change->data.tp.newtuple;
+			oldtuple = change->data.tp.oldtuple;
+			break;
+		case REORDER_BUFFER_CHANGE_DELETE:
+			op = "D";
+			oldtuple = change->data.tp.oldtuple;
+			break;
+		default:
+			return;
+	}
+
+	entry = get_relation_entry(relation);
+
+	old = MemoryContextSwitchTo(data->context);
+
+	/* ctx->out is reset here and reused for every change */
+	OutputPluginPrepareWrite(ctx, true);
+	msgpack_packer_init(&pk, ctx->out, write_to_output);
+
+	msgpack_pack_map(&pk, 2 + (newtuple != NULL) + (oldtuple != NULL));
+	pack_cstring(&pk, "op");
+	pack_cstring(&pk, op);
+	pack_cstring(&pk, "relation");
+	pack_cstring(&pk, entry->relname);
+
+	if (newtuple != NULL) {
+		pack_cstring(&pk, "new");
+		pack_tuple(&pk, entry, tupdesc, &newtuple->tuple, NULL);
+	}
+
+	if (oldtuple != NULL) {
+		pack_cstring(&pk, "old");
+		pack_tuple(&pk, entry, tupdesc, &oldtuple->tuple, entry->identity);
+	}
+
+	OutputPluginWrite(ctx, true);
+
+	MemoryContextSwitchTo(old);
+	MemoryContextReset(data->context);
+}
+
+/*
+ * Relation cache
+ */
+static RelationEntry
+get_relation_entry(Relation relation)
+{
+	RelationEntry	entry;
+	Oid				relid = RelationGetRelid(relation);
+	bool			found;
+
+	entry = (RelationEntry) hash_search(relation_cache, &relid, HASH_ENTER, &found);
+
+	if (!found)
+		entry->valid = false;
+	else if (!entry->valid)
+		free_relation_entry(entry);
+
+	if (!entry->valid)
+		build_relation_entry(entry, relation);
+
+	return entry;
+}
+
+static void
+build_relation_entry(RelationEntry entry, Relation relation)
+{
+	TupleDesc		tupdesc = RelationGetDescr(relation);
+	MemoryContext	old;
+	int				i;
+
+	old = MemoryContextSwitchTo(relation_cache_context);
+
+	entry->relname = quote_qualified_identifier(
+			get_namespace_name(RelationGetNamespace(relation)),
+			RelationGetRelationName(relation));
+
+	entry->natts = tupdesc->natts;
+	entry->attnames = palloc0(sizeof(char *) * entry->natts);
+	entry->atttypids = palloc0(sizeof(Oid) * entry->natts);
+	entry->is_msgpack = palloc0(sizeof(bool) * entry->natts);
+	entry->out_functions = palloc0(sizeof(FmgrInfo) * entry->natts);
+	entry->typisvarlena = palloc0(sizeof(bool) * entry->natts);
+
+	for (i = 0; i < entry->natts; ++i) {
+		Form_pg_attribute	attr = TupleDescAttr(tupdesc, i);
+		Oid					out_func_oid;
+
+		if (attr->attisdropped || attr->attnum < 0)
+			continue;
+
+		entry->attnames[i] = pstrdup(NameStr(attr->attname));
+		entry->atttypids[i] = attr->atttypid;
+		entry->is_msgpack[i] = type_is_msgpack(attr->atttypid);
+
+		getTypeOutputInfo(attr->atttypid, &out_func_oid, &entry->typisvarlena[i]);
+		fmgr_info_cxt(out_func_oid, &entry->out_functions[i], relation_cache_context);
+	}
+
+	if (relation->rd_rel->relreplident == REPLICA_IDENTITY_FULL)
+		entry->identity = NULL;
+	else
+		entry->identity = RelationGetIndexAttrBitmap(relation,
+				INDEX_ATTR_BITMAP_IDENTITY_KEY);
+
+	MemoryContextSwitchTo(old);
+
+	entry->valid = true;
+}
+
+static void
+free_relation_entry(RelationEntry entry)
+{
+	int i;
+
+	for (i = 0; i < entry->natts; ++i) {
+		if (entry->attnames[i] != NULL)
+			pfree(entry->attnames[i]);
+	}
+
+	pfree(entry->relname);
+	pfree(entry->attnames);
+	pfree(entry->atttypids);
+	pfree(entry->is_msgpack);
+	pfree(entry->out_functions);
+	pfree(entry->typisvarlena);
+	bms_free(entry->identity);
+}
+
+static void
+invalidate_relation_entry(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS	status;
+	RelationEntry	entry;
+
+	/* the cache may be gone after the decoding session ended */
+	if (relation_cache == NULL)
+		return;
+
+	if (OidIsValid(relid)) {
+		entry = (RelationEntry) hash_search(relation_cache, &relid, HASH_FIND, NULL);
+		if (entry != NULL)
+			entry->valid = false;
+		return;
+	}
+
+	hash_seq_init(&status, relation_cache);
+	while ((entry = (RelationEntry) hash_seq_search(&status)) != NULL)
+		entry->valid = false;
+}
+
+/*
+ * Pack functions
+ */
+static int
+write_to_output(void *data, const char *buf, unsigned int len)
+{
+	appendBinaryStringInfo((StringInfo) data, buf, len);
+	return 0;
+}
+
+static inline void
+pack_cstring(msgpack_packer *pk, const char *str)
+{
+	size_t len = strlen(str);
+	msgpack_pack_raw(pk, len);
+	msgpack_pack_raw_body(pk, str, len);
+}
+
+static void
+pack_tuple(msgpack_packer *pk, RelationEntry entry, TupleDesc tupdesc,
+		HeapTuple tuple, Bitmapset *columns)
+{
+	Datum	*values;
+	bool	*isnull;
+	bool	*skip;
+	int		ncolumns = 0;
+	int		i;
+
+	values = palloc(sizeof(Datum) * entry->natts);
+	isnull = palloc(sizeof(bool) * entry->natts);
+	skip = palloc(sizeof(bool) * entry->natts);
+
+	heap_deform_tuple(tuple, tupdesc, values, isnull);
+
+	/* the map header needs the number of columns up front */
+	for (i = 0; i < entry->natts; ++i) {
+		skip[i] = entry->attnames[i] == NULL ||
+			(columns != NULL &&
+			 !bms_is_member(i + 1 - FirstLowInvalidHeapAttributeNumber, columns)) ||
+			/* unchanged toasted values are not in the WAL */
+			(!isnull[i] && entry->typisvarlena[i] &&
+			 VARATT_IS_EXTERNAL_ONDISK(values[i]));
+
+		if (!skip[i])
+			ncolumns++;
+	}
+
+	msgpack_pack_map(pk, ncolumns);
+
+	for (i = 0; i < entry->natts; ++i) {
+		if (skip[i])
+			continue;
+
+		pack_cstring(pk, entry->attnames[i]);
+
+		if (isnull[i])
+			msgpack_pack_nil(pk);
+		else
+			pack_datum(pk, entry, i, values[i]);
+	}
+}
+
+static void
+pack_datum(msgpack_packer *pk, RelationEntry entry, int attidx, Datum value)
+{
+	struct varlena	*v;
+	char			*str;
+
+	if (entry->is_msgpack[attidx]) {
+		/* already encoded */
+		v = PG_DETOAST_DATUM_PACKED(value);
+		(* pk->callback)(pk->data, VARDATA_ANY(v), VARSIZE_ANY_EXHDR(v));
+		return;
+	}
+
+	switch (entry->atttypids[attidx]) {
+		case BOOLOID:
+			if (DatumGetBool(value))
+				msgpack_pack_true(pk);
+			else
+				msgpack_pack_false(pk);
+			break;
+
+		case INT2OID:
+			msgpack_pack_int16(pk, DatumGetInt16(value));
+			break;
+
+		case INT4OID:
+			msgpack_pack_int32(pk, DatumGetInt32(value));
+			break;
+
+		case INT8OID:
+			msgpack_pack_int64(pk, DatumGetInt64(value));
+			break;
+
+		case FLOAT4OID:
+			msgpack_pack_float(pk, DatumGetFloat4(value));
+			break;
+
+		case FLOAT8OID:
+			msgpack_pack_double(pk, DatumGetFloat8(value));
+			break;
+
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+		case BYTEAOID:
+			v = PG_DETOAST_DATUM_PACKED(value);
+			msgpack_pack_raw(pk, VARSIZE_ANY_EXHDR(v));
+			msgpack_pack_raw_body(pk, VARDATA_ANY(v), VARSIZE_ANY_EXHDR(v));
+			break;
+
+		default:
+			/* anything else in its text form */
+			str = OutputFunctionCall(&entry->out_functions[attidx], value);
+			pack_cstring(pk, str);
+			break;
+	}
+}
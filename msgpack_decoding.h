@@ -0,0 +1,9 @@
+#ifndef __MSGPACK_DECODING_H__
+#define __MSGPACK_DECODING_H__
+
+#include "replication/output_plugin.h"
+
+/* must be available to the loader of output plugins */
+void _PG_output_plugin_init(OutputPluginCallbacks *cb);
+
+#endif /* __MSGPACK_DECODING_H__ */
@@ -0,0 +1,713 @@
+#include <sys/stat.h>
+#include <msgpack.h>
+
+#include "postgres.h"
+#include "access/htup_details.h"
+#include "access/reloptions.h"
+#include "catalog/pg_authid.h"
+#include "catalog/pg_foreign_table.h"
+#include "commands/defrem.h"
+#include "commands/explain.h"
+#include "foreign/fdwapi.h"
+#include "foreign/foreign.h"
+#include "mb/pg_wchar.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "optimizer/cost.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/pathnode.h"
+#include "optimizer/planmain.h"
+#include "optimizer/restrictinfo.h"
+#include "storage/fd.h"
+#include "utils/builtins.h"
+#include "utils/float.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/typcache.h"
+
+#include "msgpack_fdw.h"
+#include "pg_msgpack.h"
+#include "convert_from_msgpack.h"
+#include "scan_msgpack.h"
+
+#if PG_VERSION_NUM < 140000
+#define ROLE_PG_READ_SERVER_FILES DEFAULT_ROLE_READ_SERVER_FILES
+#endif
+
+PG_FUNCTION_INFO_V1(msgpack_fdw_handler);
+PG_FUNCTION_INFO_V1(msgpack_fdw_validator);
+
+/* initial size of the read buffer; it grows to hold the largest record */
+#define MSGPACK_FDW_BUFFER_SIZE	(64 * 1024)
+
+/*
+ * Indexes of fdw_private of a ForeignScan
+ */
+enum MsgpackFdwPrivateIndex {
+	/* file to read */
+	MsgpackFdwPrivateFilename,
+	/* integer list of attribute numbers to be decoded */
+	MsgpackFdwPrivateAttnums,
+	/* integer list of attribute numbers compared by pushed down quals */
+	MsgpackFdwPrivateQualAttnums,
+	/* list of Consts the attributes above must be equal to */
+	MsgpackFdwPrivateQualValues
+};
+
+/*
+ * Planner state
+ */
+typedef struct {
+	char	*filename;
+	List	*attnums;
+	List	*qual_attnums;
+	List	*qual_values;
+} MsgpackFdwPlanStateData, *MsgpackFdwPlanState;
+
+/*
+ * Executor state
+ */
+typedef struct {
+	char		*filename;
+	FILE		*file;
+
+	/* read buffer; unconsumed bytes are in [buf + pos, buf + len) */
+	char		*buf;
+	size_t		size;
+	size_t		pos;
+	size_t		len;
+	bool		eof;
+
+	/* per attribute; keys are NULL for attributes not to be decoded */
+	int			natts;
+	char		**keys;
+	uint32		*keylens;
+	bool		*verbatim;	/* copy msgpack bytes instead of converting */
+	FmgrInfo	*in_functions;
+	Oid			*typioparams;
+	int32		*typmods;
+
+	/* pushed down quals, compared bytewise with the encoded value */
+	int			nquals;
+	int			*qual_attnums;
+	bytea		**qual_values;
+
+	/* values of the current record; starts are NULL for missing keys */
+	const char	**val_starts;
+	const char	**val_ends;
+} MsgpackFdwExecStateData, *MsgpackFdwExecState;
+
+/*
+ * FDW callback routines
+ */
+static void msgpackGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel,
+		Oid foreigntableid);
+static void msgpackGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel,
+		Oid foreigntableid);
+static ForeignScan *msgpackGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel,
+		Oid foreigntableid, ForeignPath *best_path, List *tlist,
+		List *scan_clauses, Plan *outer_plan);
+static void msgpackExplainForeignScan(ForeignScanState *node, ExplainState *es);
+static void msgpackBeginForeignScan(ForeignScanState *node, int eflags);
+static TupleTableSlot *msgpackIterateForeignScan(ForeignScanState *node);
+static void msgpackReScanForeignScan(ForeignScanState *node);
+static void msgpackEndForeignScan(ForeignScanState *node);
+
+/*
+ * Utility functions
+ */
+static char * get_filename(Oid foreigntableid);
+static char * get_column_key(Oid foreigntableid, AttrNumber attnum, const char *attname);
+static List * get_projected_attnums(RelOptInfo *baserel);
+static void extract_pushdown_quals(RelOptInfo *baserel, Oid foreigntableid,
+		MsgpackFdwPlanState plan_state);
+static const char * next_record(MsgpackFdwExecState state, const char **end);
+static bool match_record(MsgpackFdwExecState state, const char *p, const char *end);
+static Datum convert_value(MsgpackFdwExecState state, int attidx,
+		const char *start, const char *end, bool *isnull);
+
+
+Datum
+msgpack_fdw_handler(PG_FUNCTION_ARGS)
+{
+	FdwRoutine *fdwroutine = makeNode(FdwRoutine);
+
+	fdwroutine->GetForeignRelSize = msgpackGetForeignRelSize;
+	fdwroutine->GetForeignPaths = msgpackGetForeignPaths;
+	fdwroutine->GetForeignPlan = msgpackGetForeignPlan;
+	fdwroutine->ExplainForeignScan = msgpackExplainForeignScan;
+	fdwroutine->BeginForeignScan = msgpackBeginForeignScan;
+	fdwroutine->IterateForeignScan = msgpackIterateForeignScan;
+	fdwroutine->ReScanForeignScan = msgpackReScanForeignScan;
+	fdwroutine->EndForeignScan = msgpackEndForeignScan;
+
+	PG_RETURN_POINTER(fdwroutine);
+}
+
+Datum
+msgpack_fdw_validator(PG_FUNCTION_ARGS)
+{
+	List		*options_list = untransformRelOptions(PG_GETARG_DATUM(0));
+	Oid			catalog = PG_GETARG_OID(1);
+	char		*filename = NULL;
+	ListCell	*cell;
+
+	foreach(cell, options_list) {
+		DefElem	*def = (DefElem *) lfirst(cell);
+
+		if (catalog == ForeignTableRelationId && strcmp(def->defname, "filename") == 0) {
+			/* reading arbitrary files is the same privilege as COPY FROM a file */
+			if (!is_member_of_role(GetUserId(), ROLE_PG_READ_SERVER_FILES))
+				ereport(ERROR,
+						(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						 errmsg("only superuser or a member of the pg_read_server_files role may specify the filename option of a msgpack_fdw foreign table")));
+
+			if (filename != NULL)
+				ereport(ERROR,
+						(errcode(ERRCODE_SYNTAX_ERROR),
+						 errmsg("conflicting or redundant options")));
+			filename = defGetString(def);
+		} else if (catalog == AttributeRelationId && strcmp(def->defname, "key") == 0) {
+			(void) defGetString(def);
+		} else {
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+					 errmsg("invalid option \"%s\"", def->defname),
+					 errhint("Valid options in this context are: %s",
+						 catalog == ForeignTableRelationId ? "filename" :
+						 catalog == AttributeRelationId ? "key" : "<none>")));
+		}
+	}
+
+	if (catalog == ForeignTableRelationId && filename == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_DYNAMIC_PARAMETER_VALUE_NEEDED),
+				 errmsg("filename is required for msgpack_fdw foreign tables")));
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * FDW callback routines
+ */
+static void
+msgpackGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
+{
+	MsgpackFdwPlanState	plan_state;
+	struct stat			stat_buf;
+	BlockNumber			pages;
+	double				ntuples;
+	int					tuple_width;
+
+	plan_state = palloc0(sizeof(MsgpackFdwPlanStateData));
+	plan_state->filename = get_filename(foreigntableid);
+	plan_state->attnums = get_projected_attnums(baserel);
+	extract_pushdown_quals(baserel, foreigntableid, plan_state);
+	baserel->fdw_private = plan_state;
+
+	/* a missing file is an error at execution, not at planning */
+	if (stat(plan_state->filename, &stat_buf) < 0)
+		stat_buf.st_size = 10 * BLCKSZ;
+
+	pages = (stat_buf.st_size + (BLCKSZ - 1)) / BLCKSZ;
+	if (pages < 1)
+		pages = 1;
+
+	if (baserel->pages > 0) {
+		/* scale the density seen by the last ANALYZE */
+		double density = baserel->tuples / (double) baserel->pages;
+		ntuples = clamp_row_est(density * (double) pages);
+	} else {
+		tuple_width = MAXALIGN(baserel->reltarget->width) +
+			MAXALIGN(SizeofHeapTupleHeader);
+		ntuples = clamp_row_est((double) stat_buf.st_size / (double) tuple_width);
+	}
+	baserel->pages = pages;
+	baserel->tuples = ntuples;
+
+	baserel->rows = clamp_row_est(ntuples *
+			clauselist_selectivity(root, baserel->baserestrictinfo,
+				0, JOIN_INNER, NULL));
+}
+
+static void
+msgpackGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
+{
+	Cost	startup_cost = baserel->baserestrictcost.startup;
+	Cost	run_cost;
+
+	/* every byte of the file is read, but only projected keys are decoded */
+	run_cost = seq_page_cost * baserel->pages +
+		(cpu_tuple_cost + baserel->baserestrictcost.per_tuple) * baserel->tuples;
+
+	add_path(baserel, (Path *)
+			create_foreignscan_path(root, baserel,
+				NULL,
+				baserel->rows,
+				startup_cost,
+				startup_cost + run_cost,
+				NIL,
+				NULL,
+				NULL,
+				NIL));
+}
+
+static ForeignScan *
+msgpackGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid,
+		ForeignPath *best_path, List *tlist, List *scan_clauses, Plan *outer_plan)
+{
+	MsgpackFdwPlanState	plan_state = (MsgpackFdwPlanState) baserel->fdw_private;
+	List				*fdw_private;
+
+	/* pushed down quals are rechecked too; they only let records be skipped early */
+	scan_clauses = extract_actual_clauses(scan_clauses, false);
+
+	fdw_private = list_make4(makeString(plan_state->filename),
+			plan_state->attnums,
+			plan_state->qual_attnums,
+			plan_state->qual_values);
+
+	return make_foreignscan(tlist,
+			scan_clauses,
+			baserel->relid,
+			NIL,
+			fdw_private,
+			NIL,
+			NIL,
+			outer_plan);
+}
+
+static void
+msgpackExplainForeignScan(ForeignScanState *node, ExplainState *es)
+{
+	ForeignScan	*plan = (ForeignScan *) node->ss.ps.plan;
+	char		*filename;
+
+	filename = strVal(list_nth(plan->fdw_private, MsgpackFdwPrivateFilename));
+	ExplainPropertyText("Foreign File", filename, es);
+}
+
+static void
+msgpackBeginForeignScan(ForeignScanState *node, int eflags)
+{
+	ForeignScan			*plan = (ForeignScan *) node->ss.ps.plan;
+	Relation			rel = node->ss.ss_currentRelation;
+	TupleDesc			tupdesc = RelationGetDescr(rel);
+	MsgpackFdwExecState	state;
+	List				*attnums;
+	List				*qual_attnums;
+	List				*qual_values;
+	ListCell			*lc;
+	ListCell			*vc;
+	int					i;
+
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+		return;
+
+	state = palloc0(sizeof(MsgpackFdwExecStateData));
+	state->filename = strVal(list_nth(plan->fdw_private, MsgpackFdwPrivateFilename));
+	attnums = (List *) list_nth(plan->fdw_private, MsgpackFdwPrivateAttnums);
+	qual_attnums = (List *) list_nth(plan->fdw_private, MsgpackFdwPrivateQualAttnums);
+	qual_values = (List *) list_nth(plan->fdw_private, MsgpackFdwPrivateQualValues);
+
+	state->natts = tupdesc->natts;
+	state->keys = palloc0(sizeof(char *) * state->natts);
+	state->keylens = palloc0(sizeof(uint32) * state->natts);
+	state->verbatim = palloc0(sizeof(bool) * state->natts);
+	state->in_functions = palloc0(sizeof(FmgrInfo) * state->natts);
+	state->typioparams = palloc0(sizeof(Oid) * state->natts);
+	state->typmods = palloc0(sizeof(int32) * state->natts);
+	state->val_starts = palloc0(sizeof(char *) * state->natts);
+	state->val_ends = palloc0(sizeof(char *) * state->natts);
+
+	foreach(lc, attnums) {
+		AttrNumber			attnum = (AttrNumber) intVal(lfirst(lc));
+		Form_pg_attribute	attr = TupleDescAttr(tupdesc, attnum - 1);
+		Oid					in_func_oid;
+
+		if (attr->attisdropped)
+			continue;
+
+		i = attnum - 1;
+		state->keys[i] = get_column_key(RelationGetRelid(rel), attnum,
+				NameStr(attr->attname));
+		state->keylens[i] = strlen(state->keys[i]);
+		state->verbatim[i] = type_is_msgpack(attr->atttypid);
+		state->typmods[i] = attr->atttypmod;
+
+		getTypeInputInfo(attr->atttypid, &in_func_oid, &state->typioparams[i]);
+		fmgr_info(in_func_oid, &state->in_functions[i]);
+	}
+
+	state->nquals = list_length(qual_attnums);
+	state->qual_attnums = palloc(sizeof(int) * (state->nquals + 1));
+	state->qual_values = palloc(sizeof(bytea *) * (state->nquals + 1));
+
+	i = 0;
+	forboth(lc, qual_attnums, vc, qual_values) {
+		state->qual_attnums[i] = intVal(lfirst(lc)) - 1;
+		state->qual_values[i] = DatumGetByteaP(((Const *) lfirst(vc))->constvalue);
+		i++;
+	}
+
+	state->file = AllocateFile(state->filename, PG_BINARY_R);
+	if (state->file == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\" for reading: %m",
+					 state->filename)));
+
+	state->size = MSGPACK_FDW_BUFFER_SIZE;
+	state->buf = palloc(state->size);
+	state->pos = 0;
+	state->len = 0;
+	state->eof = false;
+
+	node->fdw_state = state;
+}
+
+static TupleTableSlot *
+msgpackIterateForeignScan(ForeignScanState *node)
+{
+	MsgpackFdwExecState	state = (MsgpackFdwExecState) node->fdw_state;
+	TupleTableSlot		*slot = node->ss.ss_ScanTupleSlot;
+	const char			*record;
+	const char			*end;
+	int					i;
+
+	ExecClearTuple(slot);
+
+	for (;;) {
+		record = next_record(state, &end);
+		if (record == NULL)
+			return slot;
+
+		if (match_record(state, record, end))
+			break;
+	}
+
+	for (i = 0; i < state->natts; ++i) {
+		if (state->keys[i] == NULL || state->val_starts[i] == NULL) {
+			slot->tts_values[i] = (Datum) 0;
+			slot->tts_isnull[i] = true;
+			continue;
+		}
+
+		slot->tts_values[i] = convert_value(state, i,
+				state->val_starts[i], state->val_ends[i], &slot->tts_isnull[i]);
+	}
+
+	ExecStoreVirtualTuple(slot);
+
+	return slot;
+}
+
+static void
+msgpackReScanForeignScan(ForeignScanState *node)
+{
+	MsgpackFdwExecState	state = (MsgpackFdwExecState) node->fdw_state;
+
+	if (fseeko(state->file, 0, SEEK_SET) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not seek in file \"%s\": %m", state->filename)));
+
+	state->pos = 0;
+	state->len = 0;
+	state->eof = false;
+}
+
+static void
+msgpackEndForeignScan(ForeignScanState *node)
+{
+	MsgpackFdwExecState	state = (MsgpackFdwExecState) node->fdw_state;
+
+	/* nothing to do in EXPLAIN */
+	if (state == NULL)
+		return;
+
+	FreeFile(state->file);
+}
+
+/*
+ * Utility functions
+ */
+static char *
+get_filename(Oid foreigntableid)
+{
+	ForeignTable	*table = GetForeignTable(foreigntableid);
+	ListCell		*lc;
+
+	foreach(lc, table->options) {
+		DefElem	*def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "filename") == 0)
+			return defGetString(def);
+	}
+
+	/* the validator makes sure this cannot happen */
+	elog(ERROR, "filename is required for msgpack_fdw foreign tables");
+	return NULL;
+}
+
+static char *
+get_column_key(Oid foreigntableid, AttrNumber attnum, const char *attname)
+{
+	List		*options = GetForeignColumnOptions(foreigntableid, attnum);
+	ListCell	*lc;
+
+	foreach(lc, options) {
+		DefElem	*def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "key") == 0)
+			return defGetString(def);
+	}
+
+	/* the column name is the key by default */
+	return pstrdup(attname);
+}
+
+static List *
+get_projected_attnums(RelOptInfo *baserel)
+{
+	Bitmapset	*attrs_used = NULL;
+	List		*attnums = NIL;
+	ListCell	*lc;
+	int			i;
+
+	pull_varattnos((Node *) baserel->reltarget->exprs, baserel->relid, &attrs_used);
+
+	foreach(lc, baserel->baserestrictinfo) {
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+		pull_varattnos((Node *) rinfo->clause, baserel->relid, &attrs_used);
+	}
+
+	i = -1;
+	while ((i = bms_next_member(attrs_used, i)) >= 0) {
+		AttrNumber attnum = i + FirstLowInvalidHeapAttributeNumber;
+
+		/* a whole-row reference needs every column */
+		if (attnum == 0) {
+			for (attnum = 1; attnum <= baserel->max_attr; ++attnum)
+				attnums = lappend(attnums, makeInteger(attnum));
+			return attnums;
+		}
+
+		if (attnum > 0)
+			attnums = lappend(attnums, makeInteger(attnum));
+	}
+
+	return attnums;
+}
+
+static void
+extract_pushdown_quals(RelOptInfo *baserel, Oid foreigntableid,
+		MsgpackFdwPlanState plan_state)
+{
+	ListCell *lc;
+
+	/*
+	 * Only "column = constant" on msgpack columns is pushed down: the default
+	 * equality of msgpack is bytewise, so it is checked on the encoded value
+	 * before anything in the record is converted.
+	 */
+	foreach(lc, baserel->baserestrictinfo) {
+		RestrictInfo	*rinfo = (RestrictInfo *) lfirst(lc);
+		OpExpr			*op;
+		Node			*left;
+		Node			*right;
+		Var				*var;
+		Const			*value;
+
+		if (!IsA(rinfo->clause, OpExpr))
+			continue;
+
+		op = (OpExpr *) rinfo->clause;
+		if (list_length(op->args) != 2)
+			continue;
+
+		left = (Node *) linitial(op->args);
+		right = (Node *) lsecond(op->args);
+
+		if (IsA(left, Var) && IsA(right, Const)) {
+			var = (Var *) left;
+			value = (Const *) right;
+		} else if (IsA(left, Const) && IsA(right, Var)) {
+			var = (Var *) right;
+			value = (Const *) left;
+		} else
+			continue;
+
+		if (var->varno != baserel->relid || var->varattno <= 0 ||
+				value->constisnull || !type_is_msgpack(var->vartype) ||
+				value->consttype != var->vartype)
+			continue;
+
+		if (op->opno != lookup_type_cache(var->vartype, TYPECACHE_EQ_OPR)->eq_opr)
+			continue;
+
+		plan_state->qual_attnums = lappend(plan_state->qual_attnums,
+				makeInteger(var->varattno));
+		plan_state->qual_values = lappend(plan_state->qual_values, value);
+	}
+}
+
+static const char *
+next_record(MsgpackFdwExecState state, const char **end)
+{
+	const char	*start;
+	size_t		nread;
+
+	for (;;) {
+		start = state->buf + state->pos;
+		*end = scan_msgpack_skip(start, state->buf + state->len);
+
+		if (*end != NULL) {
+			state->pos = *end - state->buf;
+			return start;
+		}
+
+		if (state->eof) {
+			if (state->pos == state->len)
+				return NULL;
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("invalid or truncated msgpack record at end of file \"%s\"",
+						 state->filename)));
+		}
+
+		/* keep the partial record and read more after it */
+		if (state->pos > 0) {
+			memmove(state->buf, state->buf + state->pos, state->len - state->pos);
+			state->len -= state->pos;
+			state->pos = 0;
+		}
+
+		if (state->len == state->size) {
+			state->size *= 2;
+			state->buf = repalloc(state->buf, state->size);
+		}
+
+		nread = fread(state->buf + state->len, 1, state->size - state->len, state->file);
+		if (ferror(state->file))
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read from file \"%s\": %m", state->filename)));
+
+		state->len += nread;
+		if (nread == 0)
+			state->eof = true;
+	}
+}
+
+static bool
+match_record(MsgpackFdwExecState state, const char *p, const char *end)
+{
+	ScanMsgpackHeaderData	map;
+	ScanMsgpackHeaderData	k;
+	const char				*v;
+	uint32					i;
+	int						j;
+
+	if (!scan_msgpack_header(p, end, &map) || map.type != SCAN_MSGPACK_MAP)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("msgpack record in file \"%s\" is not a map",
+					 state->filename)));
+
+	memset(state->val_starts, 0, sizeof(char *) * state->natts);
+
+	/* the record was skipped as a whole already, so it is well-formed */
+	p = map.body;
+	for (i = 0; i < map.size; ++i) {
+		scan_msgpack_header(p, end, &k);
+		v = scan_msgpack_skip(p, end);
+		p = scan_msgpack_skip(v, end);
+
+		if (k.type != SCAN_MSGPACK_RAW)
+			continue;
+
+		for (j = 0; j < state->natts; ++j) {
+			/* the first one of duplicate keys wins, the same as -> */
+			if (state->keys[j] != NULL && state->val_starts[j] == NULL &&
+					state->keylens[j] == k.size &&
+					memcmp(state->keys[j], k.body, k.size) == 0) {
+				state->val_starts[j] = v;
+				state->val_ends[j] = p;
+			}
+		}
+	}
+
+	for (j = 0; j < state->nquals; ++j) {
+		int		attidx = state->qual_attnums[j];
+		bytea	*value = state->qual_values[j];
+
+		if (state->val_starts[attidx] == NULL ||
+				state->val_ends[attidx] - state->val_starts[attidx] != VARSIZE(value) - VARHDRSZ ||
+				memcmp(state->val_starts[attidx], VARDATA(value), VARSIZE(value) - VARHDRSZ) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+static Datum
+convert_value(MsgpackFdwExecState state, int attidx, const char *start,
+		const char *end, bool *isnull)
+{
+	ScanMsgpackHeaderData	header;
+	msgpack_unpacked		msg;
+	char					*str;
+
+	*isnull = false;
+
+	if (state->verbatim[attidx])
+		return PointerGetDatum(scan_msgpack_to_bytea(start, end));
+
+	scan_msgpack_header(start, end, &header);
+
+	/* other types are read from the text form of the value */
+	switch (header.type) {
+		case SCAN_MSGPACK_NIL:
+			*isnull = true;
+			return (Datum) 0;
+
+		case SCAN_MSGPACK_BOOLEAN:
+			str = header.via.boolean ? "true" : "false";
+			break;
+
+		case SCAN_MSGPACK_POSITIVE_INTEGER:
+			str = psprintf(UINT64_FORMAT, header.via.u64);
+			break;
+
+		case SCAN_MSGPACK_NEGATIVE_INTEGER:
+			str = psprintf(INT64_FORMAT, header.via.i64);
+			break;
+
+		case SCAN_MSGPACK_FLOAT:
+		case SCAN_MSGPACK_DOUBLE:
+			str = float8out_internal(header.via.dec);
+			break;
+
+		case SCAN_MSGPACK_RAW:
+			pg_verifymbstr(header.body, header.size, false);
+			str = pnstrdup(header.body, header.size);
+			break;
+
+		default:
+			/* containers become json */
+			msgpack_unpacked_init(&msg);
+			if (!msgpack_unpack_next(&msg, start, end - start, NULL))
+				ereport(ERROR,
+						(errcode(ERRCODE_DATA_EXCEPTION),
+						 errmsg("could not convert msgpack value in file \"%s\"",
+							 state->filename)));
+			str = msgpack_to_json_string(msg.data);
+			msgpack_unpacked_destroy(&msg);
+			break;
+	}
+
+	return InputFunctionCall(&state->in_functions[attidx], str,
+			state->typioparams[attidx], state->typmods[attidx]);
+}
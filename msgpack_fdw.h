@@ -0,0 +1,9 @@
+#ifndef __MSGPACK_FDW_H__
+#define __MSGPACK_FDW_H__
+
+#include "fmgr.h"
+
+Datum msgpack_fdw_handler(PG_FUNCTION_ARGS);
+Datum msgpack_fdw_validator(PG_FUNCTION_ARGS);
+
+#endif /* __MSGPACK_FDW_H__ */
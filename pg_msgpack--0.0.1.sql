@@ -10,12 +10,16 @@ LANGUAGE c IMMUTABLE STRICT;
 CREATE FUNCTION msgpack_send(msgpack) RETURNS bytea AS
 'MODULE_PATHNAME'
 LANGUAGE c IMMUTABLE STRICT;
+CREATE FUNCTION msgpack_typanalyze(internal) RETURNS boolean AS
+'MODULE_PATHNAME'
+LANGUAGE c STRICT;
 
 CREATE TYPE msgpack (
 	INPUT = msgpack_in,
 	OUTPUT = msgpack_out,
 	RECEIVE = msgpack_recv,
-	SEND = msgpack_send
+	SEND = msgpack_send,
+	ANALYZE = msgpack_typanalyze
 );
 
 CREATE CAST (msgpack AS json) WITH INOUT;
@@ -34,6 +38,22 @@ CREATE OPERATOR -> (
 	PROCEDURE = msgpack_object_field
 );
 
+CREATE FUNCTION msgpack_exists(msgpack, text) RETURNS boolean AS
+'MODULE_PATHNAME'
+LANGUAGE c IMMUTABLE STRICT;
+
+CREATE FUNCTION msgpack_exists_sel(internal, oid, internal, integer) RETURNS float8 AS
+'MODULE_PATHNAME'
+LANGUAGE c STABLE STRICT;
+
+CREATE OPERATOR ? (
+	LEFTARG = msgpack,
+	RIGHTARG = text,
+	PROCEDURE = msgpack_exists,
+	RESTRICT = msgpack_exists_sel,
+	JOIN = contjoinsel
+);
+
 CREATE FUNCTION msgpack_array_element(msgpack, integer) RETURNS msgpack AS
 'MODULE_PATHNAME'
 LANGUAGE c IMMUTABLE STRICT;
@@ -43,3 +63,231 @@ CREATE OPERATOR -> (
 	RIGHTARG = integer,
 	PROCEDURE = msgpack_array_element
 );
+
+
+-- Comparison is bytewise, the same as bytea, so equal values only compare
+-- equal when they are encoded alike. msgpack_in always writes the narrowest
+-- formats, but other writers may not; for such data, index and compare
+-- msgpack_canonicalize(doc -> 'key') rather than doc -> 'key'.
+CREATE FUNCTION msgpack_eq(msgpack, msgpack) RETURNS boolean AS
+'byteaeq'
+LANGUAGE internal IMMUTABLE STRICT;
+CREATE FUNCTION msgpack_ne(msgpack, msgpack) RETURNS boolean AS
+'byteane'
+LANGUAGE internal IMMUTABLE STRICT;
+CREATE FUNCTION msgpack_lt(msgpack, msgpack) RETURNS boolean AS
+'bytealt'
+LANGUAGE internal IMMUTABLE STRICT;
+CREATE FUNCTION msgpack_le(msgpack, msgpack) RETURNS boolean AS
+'byteale'
+LANGUAGE internal IMMUTABLE STRICT;
+CREATE FUNCTION msgpack_gt(msgpack, msgpack) RETURNS boolean AS
+'byteagt'
+LANGUAGE internal IMMUTABLE STRICT;
+CREATE FUNCTION msgpack_ge(msgpack, msgpack) RETURNS boolean AS
+'byteage'
+LANGUAGE internal IMMUTABLE STRICT;
+CREATE FUNCTION msgpack_cmp(msgpack, msgpack) RETURNS integer AS
+'byteacmp'
+LANGUAGE internal IMMUTABLE STRICT;
+CREATE FUNCTION msgpack_hash(msgpack) RETURNS integer AS
+'hashvarlena'
+LANGUAGE internal IMMUTABLE STRICT;
+
+-- Estimates doc -> 'key' = const from the values ANALYZE samples under
+-- the most common keys, and anything else as eqsel does
+CREATE FUNCTION msgpack_eq_sel(internal, oid, internal, integer) RETURNS float8 AS
+'MODULE_PATHNAME'
+LANGUAGE c STABLE STRICT;
+
+CREATE OPERATOR = (
+	LEFTARG = msgpack,
+	RIGHTARG = msgpack,
+	PROCEDURE = msgpack_eq,
+	COMMUTATOR = =,
+	NEGATOR = <>,
+	RESTRICT = msgpack_eq_sel,
+	JOIN = eqjoinsel,
+	HASHES,
+	MERGES
+);
+
+CREATE OPERATOR <> (
+	LEFTARG = msgpack,
+	RIGHTARG = msgpack,
+	PROCEDURE = msgpack_ne,
+	COMMUTATOR = <>,
+	NEGATOR = =,
+	RESTRICT = neqsel,
+	JOIN = neqjoinsel
+);
+
+CREATE OPERATOR < (
+	LEFTARG = msgpack,
+	RIGHTARG = msgpack,
+	PROCEDURE = msgpack_lt,
+	COMMUTATOR = >,
+	NEGATOR = >=,
+	RESTRICT = scalarltsel,
+	JOIN = scalarltjoinsel
+);
+
+CREATE OPERATOR <= (
+	LEFTARG = msgpack,
+	RIGHTARG = msgpack,
+	PROCEDURE = msgpack_le,
+	COMMUTATOR = >=,
+	NEGATOR = >,
+	RESTRICT = scalarltsel,
+	JOIN = scalarltjoinsel
+);
+
+CREATE OPERATOR > (
+	LEFTARG = msgpack,
+	RIGHTARG = msgpack,
+	PROCEDURE = msgpack_gt,
+	COMMUTATOR = <,
+	NEGATOR = <=,
+	RESTRICT = scalargtsel,
+	JOIN = scalargtjoinsel
+);
+
+CREATE OPERATOR >= (
+	LEFTARG = msgpack,
+	RIGHTARG = msgpack,
+	PROCEDURE = msgpack_ge,
+	COMMUTATOR = <=,
+	NEGATOR = <,
+	RESTRICT = scalargtsel,
+	JOIN = scalargtjoinsel
+);
+
+-- Default opclasses let an expression index on (doc -> 'key') serve
+-- predicates such as doc -> 'key' = '42'::msgpack
+CREATE OPERATOR CLASS msgpack_ops
+DEFAULT FOR TYPE msgpack USING btree AS
+	OPERATOR 1 <,
+	OPERATOR 2 <=,
+	OPERATOR 3 =,
+	OPERATOR 4 >=,
+	OPERATOR 5 >,
+	FUNCTION 1 msgpack_cmp(msgpack, msgpack);
+
+CREATE OPERATOR CLASS msgpack_ops
+DEFAULT FOR TYPE msgpack USING hash AS
+	OPERATOR 1 =,
+	FUNCTION 1 msgpack_hash(msgpack);
+
+-- jsonpath evaluated over the encoded msgpack
+CREATE FUNCTION msgpack_path_exists(msgpack, jsonpath) RETURNS boolean AS
+'MODULE_PATHNAME'
+LANGUAGE c IMMUTABLE STRICT;
+CREATE FUNCTION msgpack_path_match(msgpack, jsonpath, silent boolean DEFAULT false)
+RETURNS boolean AS
+'MODULE_PATHNAME'
+LANGUAGE c IMMUTABLE STRICT;
+CREATE FUNCTION msgpack_path_match_opr(msgpack, jsonpath) RETURNS boolean AS
+'MODULE_PATHNAME'
+LANGUAGE c IMMUTABLE STRICT;
+CREATE FUNCTION msgpack_path_query(msgpack, jsonpath) RETURNS SETOF msgpack AS
+'MODULE_PATHNAME'
+LANGUAGE c IMMUTABLE STRICT;
+
+CREATE OPERATOR @? (
+	LEFTARG = msgpack,
+	RIGHTARG = jsonpath,
+	PROCEDURE = msgpack_path_exists,
+	RESTRICT = contsel,
+	JOIN = contjoinsel
+);
+
+CREATE OPERATOR @@ (
+	LEFTARG = msgpack,
+	RIGHTARG = jsonpath,
+	PROCEDURE = msgpack_path_match_opr,
+	RESTRICT = contsel,
+	JOIN = contjoinsel
+);
+
+-- Sort map keys, drop duplicate keys and use the narrowest formats, so that
+-- equal documents are encoded to identical bytes. Build expression indexes on
+-- msgpack_canonicalize(doc -> 'key') and filter with the same expression, as
+-- = on msgpack only matches identical encodings.
+CREATE FUNCTION msgpack_canonicalize(msgpack, narrow_floats boolean DEFAULT false)
+RETURNS msgpack AS
+'MODULE_PATHNAME'
+LANGUAGE c IMMUTABLE STRICT;
+
+-- Foreign data wrapper for files of concatenated msgpack maps
+CREATE FUNCTION msgpack_fdw_handler() RETURNS fdw_handler AS
+'MODULE_PATHNAME'
+LANGUAGE c STRICT;
+CREATE FUNCTION msgpack_fdw_validator(text[], oid) RETURNS void AS
+'MODULE_PATHNAME'
+LANGUAGE c STRICT;
+
+CREATE FOREIGN DATA WRAPPER msgpack_fdw
+	HANDLER msgpack_fdw_handler
+	VALIDATOR msgpack_fdw_validator;
+
+-- Set a top-level key of a map. The result is kept expanded, so repeated
+-- calls in PL/pgSQL do not encode the whole map each time
+CREATE FUNCTION msgpack_set(msgpack, text, msgpack) RETURNS msgpack AS
+'MODULE_PATHNAME'
+LANGUAGE c IMMUTABLE STRICT;
+
+-- Pick top-level keys of a map in one scan
+CREATE FUNCTION msgpack_extract_keys(msgpack, text[]) RETURNS msgpack AS
+'MODULE_PATHNAME'
+LANGUAGE c IMMUTABLE STRICT;
+CREATE FUNCTION msgpack_extract_values(msgpack, text[]) RETURNS msgpack[] AS
+'MODULE_PATHNAME'
+LANGUAGE c IMMUTABLE STRICT;
+
+-- Split a stream of concatenated msgpack values into one row per value
+CREATE FUNCTION msgpack_stream_split(bytea, validate boolean DEFAULT false)
+RETURNS SETOF msgpack AS
+'MODULE_PATHNAME'
+LANGUAGE c IMMUTABLE STRICT;
+
+-- Full text search over the strings of a document, without going through json
+CREATE FUNCTION to_tsvector(msgpack) RETURNS tsvector AS
+'MODULE_PATHNAME', 'msgpack_string_to_tsvector'
+LANGUAGE c STABLE STRICT;
+CREATE FUNCTION to_tsvector(regconfig, msgpack) RETURNS tsvector AS
+'MODULE_PATHNAME', 'msgpack_string_to_tsvector_byid'
+LANGUAGE c IMMUTABLE STRICT;
+CREATE FUNCTION to_tsvector(msgpack, jsonb) RETURNS tsvector AS
+'MODULE_PATHNAME', 'msgpack_to_tsvector'
+LANGUAGE c STABLE STRICT;
+CREATE FUNCTION to_tsvector(regconfig, msgpack, jsonb) RETURNS tsvector AS
+'MODULE_PATHNAME', 'msgpack_to_tsvector_byid'
+LANGUAGE c IMMUTABLE STRICT;
+
+CREATE FUNCTION ts_headline(msgpack, tsquery) RETURNS msgpack AS
+'MODULE_PATHNAME', 'msgpack_ts_headline'
+LANGUAGE c STABLE STRICT;
+CREATE FUNCTION ts_headline(msgpack, tsquery, text) RETURNS msgpack AS
+'MODULE_PATHNAME', 'msgpack_ts_headline_opt'
+LANGUAGE c STABLE STRICT;
+CREATE FUNCTION ts_headline(regconfig, msgpack, tsquery) RETURNS msgpack AS
+'MODULE_PATHNAME', 'msgpack_ts_headline_byid'
+LANGUAGE c IMMUTABLE STRICT;
+CREATE FUNCTION ts_headline(regconfig, msgpack, tsquery, text) RETURNS msgpack AS
+'MODULE_PATHNAME', 'msgpack_ts_headline_byid_opt'
+LANGUAGE c IMMUTABLE STRICT;
+
+-- Deltas between versions of a document, as an array of [path, value] and
+-- [path] operations
+CREATE FUNCTION msgpack_diff(msgpack, msgpack) RETURNS msgpack AS
+'MODULE_PATHNAME'
+LANGUAGE c IMMUTABLE STRICT;
+CREATE FUNCTION msgpack_patch(msgpack, msgpack) RETURNS msgpack AS
+'MODULE_PATHNAME'
+LANGUAGE c IMMUTABLE STRICT;
+
+-- Rebuild a version from a base followed by its deltas
+CREATE AGGREGATE msgpack_patch_agg(msgpack) (
+	SFUNC = msgpack_patch,
+	STYPE = msgpack
+);
@@ -1,6 +1,17 @@
 #include "postgres.h"
+#include "access/genam.h"
+#include "access/htup_details.h"
+#include "access/table.h"
+#include "catalog/indexing.h"
+#include "catalog/pg_extension.h"
+#include "catalog/pg_type.h"
+#include "commands/extension.h"
 #include "libpq/pqformat.h"
 #include "utils/bytea.h"
+#include "utils/fmgroids.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/syscache.h"
 
 #include "pg_msgpack.h"
 #include "convert_from_msgpack.h"
@@ -13,12 +24,24 @@ PG_FUNCTION_INFO_V1(msgpack_out);
 PG_FUNCTION_INFO_V1(msgpack_recv);
 PG_FUNCTION_INFO_V1(msgpack_send);
 
+/*
+ * OID of the msgpack type of this extension, looked up on first use and
+ * forgotten whenever pg_type changes, e.g. when the extension is recreated
+ */
+static Oid	msgpack_type_oid = InvalidOid;
+static bool	msgpack_type_oid_valid = false;
+
+/*
+ * private functions
+ */
+static Oid lookup_msgpack_type_oid(void);
+static Oid lookup_extension_schema(Oid extension_oid);
+static void invalidate_msgpack_type_oid(Datum arg, int cacheid, uint32 hashvalue);
+
 Datum
 msgpack_in(PG_FUNCTION_ARGS)
 {
 	char	   		*json = PG_GETARG_CSTRING(0);
-	bytea			*result;
-	msgpack_sbuffer	*buf;
 
 	if (json[0] == '\0')
 		PG_RETURN_NULL();
@@ -26,17 +49,8 @@ msgpack_in(PG_FUNCTION_ARGS)
 	if (json[0] == '\\') {
 		PG_RETURN_DATUM(DirectFunctionCall1(byteain, CStringGetDatum(json)));
 	} else {
-		buf = msgpack_sbuffer_new();
-		json_string_to_msgpack(json, buf);
-
-		result = (bytea *) palloc(buf->size + VARHDRSZ);
-		SET_VARSIZE(result, buf->size + VARHDRSZ);
-		memcpy(VARDATA(result), buf->data, buf->size);
-
-		msgpack_sbuffer_free(buf);
-
 		/* Internal representation is the same as bytea */
-		PG_RETURN_BYTEA_P(result);
+		PG_RETURN_BYTEA_P(json_string_to_msgpack(json));
 	}
 }
 
@@ -84,3 +98,82 @@ msgpack_send(PG_FUNCTION_ARGS)
 
 	PG_RETURN_BYTEA_P(data);
 }
+
+bool
+type_is_msgpack(Oid typid)
+{
+	static bool	callback_registered = false;
+
+	if (!msgpack_type_oid_valid) {
+		/* syscache callbacks cannot be unregistered, so register only once */
+		if (!callback_registered) {
+			CacheRegisterSyscacheCallback(TYPEOID,
+					invalidate_msgpack_type_oid, (Datum) 0);
+			callback_registered = true;
+		}
+
+		msgpack_type_oid = lookup_msgpack_type_oid();
+		msgpack_type_oid_valid = true;
+	}
+
+	return OidIsValid(typid) && typid == msgpack_type_oid;
+}
+
+/*
+ * private functions
+ */
+static Oid
+lookup_msgpack_type_oid(void)
+{
+	Oid		extension_oid;
+	Oid		namespace_oid;
+
+	/* the extension may not be installed in the current database */
+	extension_oid = get_extension_oid("pg_msgpack", true);
+	if (!OidIsValid(extension_oid))
+		return InvalidOid;
+
+	namespace_oid = lookup_extension_schema(extension_oid);
+	if (!OidIsValid(namespace_oid))
+		return InvalidOid;
+
+	return GetSysCacheOid2(TYPENAMENSP, Anum_pg_type_oid,
+			CStringGetDatum("msgpack"), ObjectIdGetDatum(namespace_oid));
+}
+
+/*
+ * Schema of an extension. get_extension_schema does the same but is not
+ * exported before PostgreSQL 16.
+ */
+static Oid
+lookup_extension_schema(Oid extension_oid)
+{
+	Relation	rel;
+	SysScanDesc	scan;
+	ScanKeyData	key;
+	HeapTuple	tuple;
+	Oid			result = InvalidOid;
+
+	rel = table_open(ExtensionRelationId, AccessShareLock);
+
+	ScanKeyInit(&key,
+			Anum_pg_extension_oid,
+			BTEqualStrategyNumber, F_OIDEQ,
+			ObjectIdGetDatum(extension_oid));
+	scan = systable_beginscan(rel, ExtensionOidIndexId, true, NULL, 1, &key);
+
+	tuple = systable_getnext(scan);
+	if (HeapTupleIsValid(tuple))
+		result = ((Form_pg_extension) GETSTRUCT(tuple))->extnamespace;
+
+	systable_endscan(scan);
+	table_close(rel, AccessShareLock);
+
+	return result;
+}
+
+static void
+invalidate_msgpack_type_oid(Datum arg, int cacheid, uint32 hashvalue)
+{
+	msgpack_type_oid_valid = false;
+}
@@ -8,4 +8,7 @@ Datum msgpack_out(PG_FUNCTION_ARGS);
 Datum msgpack_recv(PG_FUNCTION_ARGS);
 Datum msgpack_send(PG_FUNCTION_ARGS);
 
+/* Whether the type is msgpack */
+bool type_is_msgpack(Oid typid);
+
 #endif /* __PG_MSGPACK_H__ */
@@ -0,0 +1,810 @@
+#include "postgres.h"
+#include "access/htup_details.h"
+#include "catalog/pg_collation.h"
+#include "catalog/pg_operator.h"
+#include "catalog/pg_statistic.h"
+#include "catalog/pg_type.h"
+#include "commands/vacuum.h"
+#if PG_VERSION_NUM >= 130000
+#include "common/hashfn.h"
+#else
+#include "utils/hashutils.h"
+#endif
+#include "nodes/nodeFuncs.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/selfuncs.h"
+#include "utils/typcache.h"
+
+#include "pg_msgpack_analyze.h"
+#include "pg_msgpack_op.h"
+#include "scan_msgpack.h"
+
+PG_FUNCTION_INFO_V1(msgpack_typanalyze);
+PG_FUNCTION_INFO_V1(msgpack_exists_sel);
+PG_FUNCTION_INFO_V1(msgpack_eq_sel);
+
+/* selectivity of ? when there are no usable statistics */
+#define DEFAULT_MSGPACK_EXISTS_SEL 0.005
+
+/*
+ * pg_statistic slot kind for values under the most common keys, taken from
+ * the range reserved for private use. Each value is the msgpack array
+ * [key, value] with the fraction of documents where doc -> key = value, or
+ * [key] with the fraction for any one value of the key not listed.
+ */
+#define STATISTIC_KIND_MSGPACK_KEY_VALUES 10000
+
+/* values wider than this are not counted, as in the standard analyzer */
+#define MSGPACK_VALUE_WIDTH_THRESHOLD 1024
+
+/*
+ * State kept between msgpack_typanalyze and compute_msgpack_stats
+ */
+typedef struct {
+	AnalyzeAttrComputeStatsFunc	std_compute_stats;
+	void						*std_extra_data;
+} MsgpackAnalyzeExtraData;
+
+/*
+ * Hash table entry for counting top-level keys, and then the key-value
+ * pairs under the most common ones, with the Lossy Counting algorithm,
+ * the same way ts_typanalyze counts lexemes
+ */
+typedef struct {
+	const char	*key;
+	int			len;
+} KeyHashKey;
+
+typedef struct {
+	KeyHashKey	key;		/* must be first */
+	int			frequency;
+	int			delta;
+	int			last_row;	/* a key is counted once per document */
+	int			index;		/* position of the key in the MCELEM list, or -1 */
+} KeyTrackItem;
+
+/*
+ * private functions
+ */
+static void compute_msgpack_stats(VacAttrStats *stats,
+		AnalyzeAttrFetchFunc fetchfunc, int samplerows, double totalrows);
+static void compute_key_value_stats(VacAttrStats *stats,
+		AnalyzeAttrFetchFunc fetchfunc, int samplerows, HTAB *key_tab,
+		int num_keys, int nonnull_cnt);
+static int next_stats_slot(VacAttrStats *stats);
+static void prune_keys_hashtable(HTAB *key_tab, int b_current);
+static uint32 key_hash(const void *key, Size keysize);
+static int key_match(const void *key1, const void *key2, Size keysize);
+static int trackitem_compare_frequencies_desc(const void *e1, const void *e2);
+static Selectivity key_exists_selec(text *key, AttStatsSlot *sslot);
+static OpExpr *object_field_expr(Node *node);
+static Selectivity key_value_eq_selec(text *key, bytea *value,
+		AttStatsSlot *sslot);
+static void append_key_value(StringInfo buf, const char *key, uint32 keylen,
+		const char *value, uint32 valuelen);
+
+
+/*
+ * Statistics collected for a msgpack column are the standard whole-value
+ * ones, the presence fraction of the most common top-level keys for the ?
+ * operator, and the most common scalar values under those keys for
+ * doc -> 'key' = const.
+ */
+Datum
+msgpack_typanalyze(PG_FUNCTION_ARGS)
+{
+	VacAttrStats			*stats = (VacAttrStats *) PG_GETARG_POINTER(0);
+	MsgpackAnalyzeExtraData	*extra;
+
+	/* whole-value MCVs and histogram come from the standard analyzer */
+	if (!std_typanalyze(stats))
+		PG_RETURN_BOOL(false);
+
+	extra = palloc(sizeof(MsgpackAnalyzeExtraData));
+	extra->std_compute_stats = stats->compute_stats;
+	extra->std_extra_data = stats->extra_data;
+
+	stats->extra_data = extra;
+	stats->compute_stats = compute_msgpack_stats;
+
+	PG_RETURN_BOOL(true);
+}
+
+Datum
+msgpack_exists_sel(PG_FUNCTION_ARGS)
+{
+	PlannerInfo			*root = (PlannerInfo *) PG_GETARG_POINTER(0);
+	List				*args = (List *) PG_GETARG_POINTER(2);
+	int					varRelid = PG_GETARG_INT32(3);
+	VariableStatData	vardata;
+	Node				*other;
+	bool				varonleft;
+	Selectivity			selec;
+
+	if (!get_restriction_variable(root, args, varRelid,
+				&vardata, &other, &varonleft))
+		PG_RETURN_FLOAT8(DEFAULT_MSGPACK_EXISTS_SEL);
+
+	if (!varonleft || !IsA(other, Const)) {
+		ReleaseVariableStats(vardata);
+		PG_RETURN_FLOAT8(DEFAULT_MSGPACK_EXISTS_SEL);
+	}
+
+	if (((Const *) other)->constisnull) {
+		ReleaseVariableStats(vardata);
+		PG_RETURN_FLOAT8(0.0);
+	}
+
+	if (HeapTupleIsValid(vardata.statsTuple)) {
+		Form_pg_statistic	stats;
+		AttStatsSlot		sslot;
+
+		stats = (Form_pg_statistic) GETSTRUCT(vardata.statsTuple);
+
+		if (get_attstatsslot(&sslot, vardata.statsTuple,
+					STATISTIC_KIND_MCELEM, InvalidOid,
+					ATTSTATSSLOT_VALUES | ATTSTATSSLOT_NUMBERS)) {
+			selec = key_exists_selec(
+					DatumGetTextPP(((Const *) other)->constvalue), &sslot);
+			free_attstatsslot(&sslot);
+		} else
+			selec = DEFAULT_MSGPACK_EXISTS_SEL;
+
+		/* only non-null documents can contain a key */
+		selec *= (1.0 - stats->stanullfrac);
+	} else
+		selec = DEFAULT_MSGPACK_EXISTS_SEL;
+
+	ReleaseVariableStats(vardata);
+
+	CLAMP_PROBABILITY(selec);
+
+	PG_RETURN_FLOAT8((float8) selec);
+}
+
+/*
+ * Restriction selectivity of =. Only doc -> 'key' = const is estimated
+ * here, from the values sampled under the key; anything else, including
+ * an expression with statistics of its own, is left to eqsel.
+ */
+Datum
+msgpack_eq_sel(PG_FUNCTION_ARGS)
+{
+	PlannerInfo			*root = (PlannerInfo *) PG_GETARG_POINTER(0);
+	List				*args = (List *) PG_GETARG_POINTER(2);
+	int					varRelid = PG_GETARG_INT32(3);
+	VariableStatData	vardata;
+	VariableStatData	docdata;
+	Node				*other;
+	bool				varonleft;
+	OpExpr				*field;
+	Const				*key;
+	Selectivity			selec;
+
+	if (!get_restriction_variable(root, args, varRelid,
+				&vardata, &other, &varonleft))
+		return eqsel(fcinfo);
+
+	if (HeapTupleIsValid(vardata.statsTuple) || !IsA(other, Const) ||
+			(field = object_field_expr(vardata.var)) == NULL) {
+		ReleaseVariableStats(vardata);
+		return eqsel(fcinfo);
+	}
+
+	ReleaseVariableStats(vardata);
+
+	if (((Const *) other)->constisnull)
+		PG_RETURN_FLOAT8(0.0);
+
+	key = (Const *) lsecond(field->args);
+	examine_variable(root, (Node *) linitial(field->args), varRelid, &docdata);
+
+	if (HeapTupleIsValid(docdata.statsTuple)) {
+		Form_pg_statistic	stats;
+		AttStatsSlot		sslot;
+
+		stats = (Form_pg_statistic) GETSTRUCT(docdata.statsTuple);
+
+		if (get_attstatsslot(&sslot, docdata.statsTuple,
+					STATISTIC_KIND_MSGPACK_KEY_VALUES, InvalidOid,
+					ATTSTATSSLOT_VALUES | ATTSTATSSLOT_NUMBERS)) {
+			selec = key_value_eq_selec(DatumGetTextPP(key->constvalue),
+					DatumGetByteaPP(((Const *) other)->constvalue), &sslot);
+			free_attstatsslot(&sslot);
+		} else
+			selec = DEFAULT_EQ_SEL;
+
+		/* -> yields null for null documents */
+		selec *= (1.0 - stats->stanullfrac);
+	} else
+		selec = DEFAULT_EQ_SEL;
+
+	ReleaseVariableStats(docdata);
+
+	CLAMP_PROBABILITY(selec);
+
+	PG_RETURN_FLOAT8((float8) selec);
+}
+
+/*
+ * private functions
+ */
+static void
+compute_msgpack_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
+		int samplerows, double totalrows)
+{
+	MsgpackAnalyzeExtraData	*extra = (MsgpackAnalyzeExtraData *) stats->extra_data;
+	int						num_mcelem;
+	int						nonnull_cnt = 0;
+	int						key_no = 0;
+	int						bucket_width;
+	int						b_current;
+	HTAB					*key_tab;
+	HASHCTL					hash_ctl;
+	HASH_SEQ_STATUS			scan_status;
+	KeyTrackItem			*item;
+	KeyHashKey				hash_key;
+	bool					found;
+	int						i;
+
+	/* let the standard analyzer fill in whole-value statistics first */
+	stats->extra_data = extra->std_extra_data;
+	extra->std_compute_stats(stats, fetchfunc, samplerows, totalrows);
+	stats->extra_data = extra;
+
+	/* keep as many keys as an array column keeps elements */
+	num_mcelem = stats->attr->attstattarget * 10;
+	bucket_width = (num_mcelem + 10) * 1000 / 7;
+
+	MemSet(&hash_ctl, 0, sizeof(hash_ctl));
+	hash_ctl.keysize = sizeof(KeyHashKey);
+	hash_ctl.entrysize = sizeof(KeyTrackItem);
+	hash_ctl.hash = key_hash;
+	hash_ctl.match = key_match;
+	hash_ctl.hcxt = CurrentMemoryContext;
+	key_tab = hash_create("Analyzed msgpack keys",
+			num_mcelem,
+			&hash_ctl,
+			HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+
+	b_current = 1;
+
+	for (i = 0; i < samplerows; i++) {
+		Datum					value;
+		bool					isnull;
+		bytea					*data;
+		const char				*p;
+		const char				*end;
+		const char				*v;
+		ScanMsgpackHeaderData	map;
+		ScanMsgpackHeaderData	k;
+		uint32					j;
+
+		vacuum_delay_point();
+
+		value = fetchfunc(stats, i, &isnull);
+		if (isnull)
+			continue;
+
+		nonnull_cnt++;
+
+		data = DatumGetByteaP(value);
+		p = VARDATA(data);
+		end = p + VARSIZE(data) - VARHDRSZ;
+
+		if (!scan_msgpack_header(p, end, &map) || map.type != SCAN_MSGPACK_MAP)
+			goto next_row;
+
+		p = map.body;
+		for (j = 0; j < map.size; j++) {
+			if (!scan_msgpack_header(p, end, &k))
+				break;
+
+			if (k.type == SCAN_MSGPACK_RAW)
+				v = k.body + k.size;
+			else if ((v = scan_msgpack_skip(p, end)) == NULL)
+				break;
+
+			if ((p = scan_msgpack_skip(v, end)) == NULL)
+				break;
+
+			if (k.type != SCAN_MSGPACK_RAW)
+				continue;
+
+			hash_key.key = k.body;
+			hash_key.len = k.size;
+			item = (KeyTrackItem *) hash_search(key_tab, &hash_key,
+					HASH_ENTER, &found);
+
+			if (found) {
+				if (item->last_row == i)
+					continue;
+				item->frequency++;
+			} else {
+				/* the key points into the document; keep our own copy */
+				char *copy = palloc(k.size);
+				memcpy(copy, k.body, k.size);
+				item->key.key = copy;
+				item->frequency = 1;
+				item->delta = b_current - 1;
+				item->index = -1;
+			}
+			item->last_row = i;
+
+			key_no++;
+
+			if (key_no % bucket_width == 0) {
+				prune_keys_hashtable(key_tab, b_current);
+				b_current++;
+			}
+		}
+
+next_row:
+		if ((Pointer) data != DatumGetPointer(value))
+			pfree(data);
+	}
+
+	if (nonnull_cnt > 0) {
+		KeyTrackItem	**sort_table;
+		int				track_len;
+		int				cutoff_freq;
+		int				minfreq;
+		int				maxfreq;
+		int				slot_idx;
+		Datum			*mcelem_values;
+		float4			*mcelem_freqs;
+		MemoryContext	old_context;
+
+		/* drop keys that may have been underestimated by pruning */
+		cutoff_freq = 9 * key_no / bucket_width;
+
+		sort_table = palloc(sizeof(KeyTrackItem *) * hash_get_num_entries(key_tab));
+
+		track_len = 0;
+		hash_seq_init(&scan_status, key_tab);
+		while ((item = (KeyTrackItem *) hash_seq_search(&scan_status)) != NULL) {
+			if (item->frequency > cutoff_freq)
+				sort_table[track_len++] = item;
+		}
+
+		if (num_mcelem > track_len)
+			num_mcelem = track_len;
+
+		if (num_mcelem > 0) {
+			qsort(sort_table, track_len, sizeof(KeyTrackItem *),
+					trackitem_compare_frequencies_desc);
+
+			maxfreq = sort_table[0]->frequency;
+			minfreq = sort_table[num_mcelem - 1]->frequency;
+
+			/* results must live as long as the VacAttrStats */
+			old_context = MemoryContextSwitchTo(stats->anl_context);
+
+			mcelem_values = palloc(num_mcelem * sizeof(Datum));
+			/* as for MCELEM of arrays, min and max frequencies follow */
+			mcelem_freqs = palloc((num_mcelem + 2) * sizeof(float4));
+
+			for (i = 0; i < num_mcelem; i++) {
+				item = sort_table[i];
+				mcelem_values[i] = PointerGetDatum(
+						cstring_to_text_with_len(item->key.key, item->key.len));
+				mcelem_freqs[i] = (double) item->frequency / (double) nonnull_cnt;
+
+				/* mark the key for compute_key_value_stats */
+				item->index = i;
+				item->last_row = -1;
+			}
+			mcelem_freqs[i++] = (double) minfreq / (double) nonnull_cnt;
+			mcelem_freqs[i] = (double) maxfreq / (double) nonnull_cnt;
+
+			MemoryContextSwitchTo(old_context);
+
+			slot_idx = next_stats_slot(stats);
+
+			stats->stakind[slot_idx] = STATISTIC_KIND_MCELEM;
+			stats->staop[slot_idx] = TextEqualOperator;
+			stats->stacoll[slot_idx] = DEFAULT_COLLATION_OID;
+			stats->stanumbers[slot_idx] = mcelem_freqs;
+			stats->numnumbers[slot_idx] = num_mcelem + 2;
+			stats->stavalues[slot_idx] = mcelem_values;
+			stats->numvalues[slot_idx] = num_mcelem;
+			stats->statypid[slot_idx] = TEXTOID;
+			stats->statyplen[slot_idx] = -1;
+			stats->statypbyval[slot_idx] = false;
+			stats->statypalign[slot_idx] = 'i';
+
+			compute_key_value_stats(stats, fetchfunc, samplerows, key_tab,
+					num_mcelem, nonnull_cnt);
+		}
+	}
+
+	hash_destroy(key_tab);
+}
+
+/*
+ * Count the scalar values under the keys of key_tab that have an index,
+ * taking the first entry for a key in a document as -> does, and store
+ * the most common pairs in a STATISTIC_KIND_MSGPACK_KEY_VALUES slot.
+ */
+static void
+compute_key_value_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
+		int samplerows, HTAB *key_tab, int num_keys, int nonnull_cnt)
+{
+	int				num_pairs;
+	int				pair_no = 0;
+	int				bucket_width;
+	int				b_current;
+	int				cutoff_freq;
+	int				rest_freq;
+	int				track_len;
+	int				slot_idx;
+	int				*key_counts;
+	int				*listed_counts;
+	HTAB			*pair_tab;
+	HASHCTL			hash_ctl;
+	HASH_SEQ_STATUS	scan_status;
+	KeyTrackItem	*key_item;
+	KeyTrackItem	*item;
+	KeyTrackItem	**sort_table;
+	KeyHashKey		hash_key;
+	StringInfoData	buf;
+	Datum			*kv_values;
+	float4			*kv_freqs;
+	MemoryContext	old_context;
+	bool			found;
+	int				i;
+
+	num_pairs = stats->attr->attstattarget * 10;
+	bucket_width = (num_pairs + 10) * 1000 / 7;
+
+	MemSet(&hash_ctl, 0, sizeof(hash_ctl));
+	hash_ctl.keysize = sizeof(KeyHashKey);
+	hash_ctl.entrysize = sizeof(KeyTrackItem);
+	hash_ctl.hash = key_hash;
+	hash_ctl.match = key_match;
+	hash_ctl.hcxt = CurrentMemoryContext;
+	pair_tab = hash_create("Analyzed msgpack key-value pairs",
+			num_pairs,
+			&hash_ctl,
+			HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+
+	/* documents having each key, and those whose value under it is listed */
+	key_counts = palloc0(num_keys * sizeof(int));
+	listed_counts = palloc0(num_keys * sizeof(int));
+
+	initStringInfo(&buf);
+	b_current = 1;
+
+	for (i = 0; i < samplerows; i++) {
+		Datum					value;
+		bool					isnull;
+		bytea					*data;
+		const char				*p;
+		const char				*end;
+		const char				*v;
+		ScanMsgpackHeaderData	map;
+		ScanMsgpackHeaderData	k;
+		ScanMsgpackHeaderData	val;
+		uint32					j;
+
+		vacuum_delay_point();
+
+		value = fetchfunc(stats, i, &isnull);
+		if (isnull)
+			continue;
+
+		data = DatumGetByteaP(value);
+		p = VARDATA(data);
+		end = p + VARSIZE(data) - VARHDRSZ;
+
+		if (!scan_msgpack_header(p, end, &map) || map.type != SCAN_MSGPACK_MAP)
+			goto next_row;
+
+		p = map.body;
+		for (j = 0; j < map.size; j++) {
+			if (!scan_msgpack_header(p, end, &k))
+				break;
+
+			if (k.type == SCAN_MSGPACK_RAW)
+				v = k.body + k.size;
+			else if ((v = scan_msgpack_skip(p, end)) == NULL)
+				break;
+
+			if ((p = scan_msgpack_skip(v, end)) == NULL)
+				break;
+
+			if (k.type != SCAN_MSGPACK_RAW)
+				continue;
+
+			hash_key.key = k.body;
+			hash_key.len = k.size;
+			key_item = (KeyTrackItem *) hash_search(key_tab, &hash_key,
+					HASH_FIND, NULL);
+
+			if (key_item == NULL || key_item->index < 0 || key_item->last_row == i)
+				continue;
+			key_item->last_row = i;
+			key_counts[key_item->index]++;
+
+			/* containers and wide values are left to the rest frequency */
+			if (p - v > MSGPACK_VALUE_WIDTH_THRESHOLD ||
+					!scan_msgpack_header(v, p, &val) ||
+					val.type == SCAN_MSGPACK_ARRAY || val.type == SCAN_MSGPACK_MAP)
+				continue;
+
+			resetStringInfo(&buf);
+			append_key_value(&buf, k.body, k.size, v, p - v);
+
+			hash_key.key = buf.data;
+			hash_key.len = buf.len;
+			item = (KeyTrackItem *) hash_search(pair_tab, &hash_key,
+					HASH_ENTER, &found);
+
+			if (found)
+				item->frequency++;
+			else {
+				/* the key points into buf; keep our own copy */
+				char *copy = palloc(buf.len);
+				memcpy(copy, buf.data, buf.len);
+				item->key.key = copy;
+				item->frequency = 1;
+				item->delta = b_current - 1;
+				item->index = key_item->index;
+			}
+
+			pair_no++;
+
+			if (pair_no % bucket_width == 0) {
+				prune_keys_hashtable(pair_tab, b_current);
+				b_current++;
+			}
+		}
+
+next_row:
+		if ((Pointer) data != DatumGetPointer(value))
+			pfree(data);
+	}
+
+	/*
+	 * As for MCVs, a pair seen once is not listed, and neither are those
+	 * that pruning may have underestimated
+	 */
+	cutoff_freq = 9 * pair_no / bucket_width;
+
+	sort_table = palloc(sizeof(KeyTrackItem *) *
+			Max(hash_get_num_entries(pair_tab), 1));
+
+	track_len = 0;
+	hash_seq_init(&scan_status, pair_tab);
+	while ((item = (KeyTrackItem *) hash_seq_search(&scan_status)) != NULL) {
+		if (item->frequency > cutoff_freq && item->frequency > 1)
+			sort_table[track_len++] = item;
+	}
+
+	/* a pair not listed is no more common than the rarest one that could be */
+	rest_freq = Max(cutoff_freq, 1);
+
+	if (num_pairs >= track_len)
+		num_pairs = track_len;
+	else {
+		qsort(sort_table, track_len, sizeof(KeyTrackItem *),
+				trackitem_compare_frequencies_desc);
+		rest_freq = sort_table[num_pairs - 1]->frequency;
+	}
+
+	/* results must live as long as the VacAttrStats */
+	old_context = MemoryContextSwitchTo(stats->anl_context);
+
+	kv_values = palloc((num_pairs + num_keys) * sizeof(Datum));
+	kv_freqs = palloc((num_pairs + num_keys) * sizeof(float4));
+
+	for (i = 0; i < num_pairs; i++) {
+		item = sort_table[i];
+		kv_values[i] = PointerGetDatum(scan_msgpack_to_bytea(item->key.key,
+					item->key.key + item->key.len));
+		kv_freqs[i] = (double) item->frequency / (double) nonnull_cnt;
+		listed_counts[item->index] += item->frequency;
+	}
+
+	/* the [key] entries follow, in the order of the MCELEM list */
+	hash_seq_init(&scan_status, key_tab);
+	while ((item = (KeyTrackItem *) hash_seq_search(&scan_status)) != NULL) {
+		if (item->index < 0)
+			continue;
+
+		resetStringInfo(&buf);
+		append_key_value(&buf, item->key.key, item->key.len, NULL, 0);
+
+		kv_values[num_pairs + item->index] = PointerGetDatum(
+				scan_msgpack_to_bytea(buf.data, buf.data + buf.len));
+		kv_freqs[num_pairs + item->index] =
+			Min(key_counts[item->index] - listed_counts[item->index],
+					rest_freq / 2.0) / (double) nonnull_cnt;
+	}
+
+	MemoryContextSwitchTo(old_context);
+
+	slot_idx = next_stats_slot(stats);
+
+	stats->stakind[slot_idx] = STATISTIC_KIND_MSGPACK_KEY_VALUES;
+	stats->staop[slot_idx] = lookup_type_cache(stats->attrtypid,
+			TYPECACHE_EQ_OPR)->eq_opr;
+	stats->stacoll[slot_idx] = InvalidOid;
+	stats->stanumbers[slot_idx] = kv_freqs;
+	stats->numnumbers[slot_idx] = num_pairs + num_keys;
+	stats->stavalues[slot_idx] = kv_values;
+	stats->numvalues[slot_idx] = num_pairs + num_keys;
+	stats->statypid[slot_idx] = stats->attrtypid;
+	stats->statyplen[slot_idx] = stats->attrtype->typlen;
+	stats->statypbyval[slot_idx] = stats->attrtype->typbyval;
+	stats->statypalign[slot_idx] = stats->attrtype->typalign;
+
+	hash_destroy(pair_tab);
+}
+
+static int
+next_stats_slot(VacAttrStats *stats)
+{
+	int slot_idx = 0;
+
+	while (slot_idx < STATISTIC_NUM_SLOTS && stats->stakind[slot_idx] != 0)
+		slot_idx++;
+	if (slot_idx >= STATISTIC_NUM_SLOTS)
+		elog(ERROR, "insufficient pg_statistic slots for msgpack stats");
+
+	return slot_idx;
+}
+
+static void
+prune_keys_hashtable(HTAB *key_tab, int b_current)
+{
+	HASH_SEQ_STATUS	scan_status;
+	KeyTrackItem	*item;
+
+	hash_seq_init(&scan_status, key_tab);
+	while ((item = (KeyTrackItem *) hash_seq_search(&scan_status)) != NULL) {
+		if (item->frequency + item->delta <= b_current) {
+			char *key = (char *) item->key.key;
+
+			if (hash_search(key_tab, &item->key, HASH_REMOVE, NULL) == NULL)
+				elog(ERROR, "hash table corrupted");
+			pfree(key);
+		}
+	}
+}
+
+static uint32
+key_hash(const void *key, Size keysize)
+{
+	const KeyHashKey *k = (const KeyHashKey *) key;
+
+	return DatumGetUInt32(hash_any((const unsigned char *) k->key, k->len));
+}
+
+static int
+key_match(const void *key1, const void *key2, Size keysize)
+{
+	const KeyHashKey *k1 = (const KeyHashKey *) key1;
+	const KeyHashKey *k2 = (const KeyHashKey *) key2;
+
+	if (k1->len != k2->len)
+		return 1;
+	return memcmp(k1->key, k2->key, k1->len);
+}
+
+static int
+trackitem_compare_frequencies_desc(const void *e1, const void *e2)
+{
+	const KeyTrackItem *t1 = *((const KeyTrackItem *const *) e1);
+	const KeyTrackItem *t2 = *((const KeyTrackItem *const *) e2);
+
+	return t2->frequency - t1->frequency;
+}
+
+static Selectivity
+key_exists_selec(text *key, AttStatsSlot *sslot)
+{
+	const char	*keystr = VARDATA_ANY(key);
+	int			keylen = VARSIZE_ANY_EXHDR(key);
+	float4		minfreq;
+	int			i;
+
+	/* there must be the min and max frequencies after the key frequencies */
+	if (sslot->nnumbers != sslot->nvalues + 2)
+		return DEFAULT_MSGPACK_EXISTS_SEL;
+
+	for (i = 0; i < sslot->nvalues; i++) {
+		text *value = DatumGetTextPP(sslot->values[i]);
+
+		if (VARSIZE_ANY_EXHDR(value) == keylen &&
+				memcmp(VARDATA_ANY(value), keystr, keylen) == 0)
+			return sslot->numbers[i];
+	}
+
+	/* a key not in the list is rarer than the rarest one in it */
+	minfreq = sslot->numbers[sslot->nvalues];
+	return Min(DEFAULT_MSGPACK_EXISTS_SEL, minfreq / 2);
+}
+
+/* Return node if it is msgpack -> text with a constant key, else NULL */
+static OpExpr *
+object_field_expr(Node *node)
+{
+	OpExpr		*op;
+	Node		*key;
+	FmgrInfo	finfo;
+
+	if (IsA(node, RelabelType))
+		node = (Node *) ((RelabelType *) node)->arg;
+
+	if (!IsA(node, OpExpr))
+		return NULL;
+
+	op = (OpExpr *) node;
+	if (list_length(op->args) != 2)
+		return NULL;
+
+	key = (Node *) lsecond(op->args);
+	if (!IsA(key, Const) || ((Const *) key)->constisnull)
+		return NULL;
+
+	/* the operator is recognized by the C function behind it */
+	set_opfuncid(op);
+	fmgr_info(op->opfuncid, &finfo);
+	if (finfo.fn_addr != msgpack_object_field)
+		return NULL;
+
+	return op;
+}
+
+static Selectivity
+key_value_eq_selec(text *key, bytea *value, AttStatsSlot *sslot)
+{
+	StringInfoData	pair;
+	StringInfoData	rest;
+	Selectivity		selec = DEFAULT_EQ_SEL;
+	int				i;
+
+	if (sslot->nnumbers != sslot->nvalues)
+		return DEFAULT_EQ_SEL;
+
+	initStringInfo(&pair);
+	append_key_value(&pair, VARDATA_ANY(key), VARSIZE_ANY_EXHDR(key),
+			VARDATA_ANY(value), VARSIZE_ANY_EXHDR(value));
+
+	initStringInfo(&rest);
+	append_key_value(&rest, VARDATA_ANY(key), VARSIZE_ANY_EXHDR(key), NULL, 0);
+
+	/* a listed pair wins over the rest frequency of its key */
+	for (i = 0; i < sslot->nvalues; i++) {
+		bytea		*entry = DatumGetByteaPP(sslot->values[i]);
+		const char	*p = VARDATA_ANY(entry);
+		int			len = VARSIZE_ANY_EXHDR(entry);
+
+		if (len == pair.len && memcmp(p, pair.data, len) == 0) {
+			selec = sslot->numbers[i];
+			break;
+		}
+		if (len == rest.len && memcmp(p, rest.data, len) == 0)
+			selec = sslot->numbers[i];
+	}
+
+	pfree(pair.data);
+	pfree(rest.data);
+
+	return selec;
+}
+
+/* Append the msgpack array [key, value], or [key] if value is NULL */
+static void
+append_key_value(StringInfo buf, const char *key, uint32 keylen,
+		const char *value, uint32 valuelen)
+{
+	scan_msgpack_append_header(buf, SCAN_MSGPACK_ARRAY, value != NULL ? 2 : 1);
+	scan_msgpack_append_header(buf, SCAN_MSGPACK_RAW, keylen);
+	appendBinaryStringInfo(buf, key, keylen);
+	if (value != NULL)
+		appendBinaryStringInfo(buf, value, valuelen);
+}
@@ -0,0 +1,10 @@
+#ifndef __PG_MSGPACK_ANALYZE_H__
+#define __PG_MSGPACK_ANALYZE_H__
+
+#include "fmgr.h"
+
+Datum msgpack_typanalyze(PG_FUNCTION_ARGS);
+Datum msgpack_exists_sel(PG_FUNCTION_ARGS);
+Datum msgpack_eq_sel(PG_FUNCTION_ARGS);
+
+#endif /* __PG_MSGPACK_ANALYZE_H__ */
@@ -0,0 +1,252 @@
+#include <msgpack.h>
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "pg_msgpack_canonical.h"
+#include "scan_msgpack.h"
+
+PG_FUNCTION_INFO_V1(msgpack_canonicalize);
+
+/*
+ * An entry of a map being canonicalized
+ */
+typedef struct {
+	ScanMsgpackHeaderData	key;
+	/* canonical encoding of the key, as an offset into a shared buffer */
+	size_t					ckey_offset;
+	size_t					ckey_len;
+	const char				*ckey;
+	const char				*val;
+	uint32					index;	/* position in the source map */
+} MapEntryData, *MapEntry;
+
+/*
+ * private functions
+ */
+static void canonicalize_value(msgpack_packer *pk, const char *p, const char *end,
+		bool narrow_floats);
+static void canonicalize_map(msgpack_packer *pk, const ScanMsgpackHeader map,
+		const char *end, bool narrow_floats);
+static int map_entry_cmp(const void *a, const void *b);
+static int key_cmp(const MapEntryData *a, const MapEntryData *b);
+
+
+Datum
+msgpack_canonicalize(PG_FUNCTION_ARGS)
+{
+	bytea			*data = PG_GETARG_BYTEA_P(0);
+	bool			narrow_floats = PG_GETARG_BOOL(1);
+	const char		*start = VARDATA(data);
+	const char		*end = start + VARSIZE(data) - VARHDRSZ;
+	bytea			*result;
+	msgpack_sbuffer	sbuf;
+	msgpack_packer	pk;
+
+	msgpack_sbuffer_init(&sbuf);
+	msgpack_packer_init(&pk, &sbuf, msgpack_sbuffer_write);
+
+	canonicalize_value(&pk, start, end, narrow_floats);
+
+	result = (bytea *) palloc(sbuf.size + VARHDRSZ);
+	SET_VARSIZE(result, sbuf.size + VARHDRSZ);
+	memcpy(VARDATA(result), sbuf.data, sbuf.size);
+
+	msgpack_sbuffer_destroy(&sbuf);
+
+	PG_RETURN_BYTEA_P(result);
+}
+
+/*
+ * private functions
+ */
+static void
+canonicalize_value(msgpack_packer *pk, const char *p, const char *end, bool narrow_floats)
+{
+	ScanMsgpackHeaderData	header;
+	char					buf[SCAN_MSGPACK_MAX_HEADER_SIZE];
+	char					*buf_end;
+	uint32					i;
+
+	check_stack_depth();
+
+	if (!scan_msgpack_header(p, end, &header))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid msgpack value")));
+
+	/* the packer always chooses the narrowest format */
+	switch (header.type) {
+		case SCAN_MSGPACK_NIL:
+			msgpack_pack_nil(pk);
+			break;
+
+		case SCAN_MSGPACK_BOOLEAN:
+			if (header.via.boolean)
+				msgpack_pack_true(pk);
+			else
+				msgpack_pack_false(pk);
+			break;
+
+		case SCAN_MSGPACK_POSITIVE_INTEGER:
+			msgpack_pack_uint64(pk, header.via.u64);
+			break;
+
+		case SCAN_MSGPACK_NEGATIVE_INTEGER:
+			msgpack_pack_int64(pk, header.via.i64);
+			break;
+
+		case SCAN_MSGPACK_FLOAT:
+			msgpack_pack_float(pk, (float) header.via.dec);
+			break;
+
+		case SCAN_MSGPACK_DOUBLE:
+			/* only narrow when float32 holds the value exactly */
+			if (narrow_floats && (double) (float) header.via.dec == header.via.dec)
+				msgpack_pack_float(pk, (float) header.via.dec);
+			else
+				msgpack_pack_double(pk, header.via.dec);
+			break;
+
+		case SCAN_MSGPACK_RAW:
+			msgpack_pack_raw(pk, header.size);
+			msgpack_pack_raw_body(pk, header.body, header.size);
+			break;
+
+		case SCAN_MSGPACK_BIN:
+		case SCAN_MSGPACK_EXT:
+			/* the packer has no formats for these, so write the header here */
+			if (header.type == SCAN_MSGPACK_BIN)
+				buf_end = scan_msgpack_write_header(buf, SCAN_MSGPACK_BIN, header.size);
+			else
+				buf_end = scan_msgpack_write_ext_header(buf, header.via.ext_type,
+						header.size);
+
+			(* pk->callback)(pk->data, buf, buf_end - buf);
+			(* pk->callback)(pk->data, header.body, header.size);
+			break;
+
+		case SCAN_MSGPACK_ARRAY:
+			msgpack_pack_array(pk, header.size);
+			p = header.body;
+			for (i = 0; i < header.size; ++i) {
+				canonicalize_value(pk, p, end, narrow_floats);
+				p = scan_msgpack_skip_or_error(p, end);
+			}
+			break;
+
+		case SCAN_MSGPACK_MAP:
+			canonicalize_map(pk, &header, end, narrow_floats);
+			break;
+	}
+}
+
+static void
+canonicalize_map(msgpack_packer *pk, const ScanMsgpackHeader map, const char *end,
+		bool narrow_floats)
+{
+	MapEntry		entries;
+	const char		*p = map->body;
+	msgpack_sbuffer	keybuf;
+	msgpack_packer	keypk;
+	uint32			nunique;
+	uint32			i;
+
+	if (map->size == 0) {
+		msgpack_pack_map(pk, 0);
+		return;
+	}
+
+	entries = palloc(sizeof(MapEntryData) * map->size);
+
+	/*
+	 * Keys are canonicalized before they are compared, so that keys encoded
+	 * in different widths are recognized as equal
+	 */
+	msgpack_sbuffer_init(&keybuf);
+	msgpack_packer_init(&keypk, &keybuf, msgpack_sbuffer_write);
+
+	for (i = 0; i < map->size; ++i) {
+		if (!scan_msgpack_header(p, end, &entries[i].key))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid msgpack value")));
+
+		entries[i].ckey_offset = keybuf.size;
+		canonicalize_value(&keypk, p, end, narrow_floats);
+		entries[i].ckey_len = keybuf.size - entries[i].ckey_offset;
+
+		entries[i].val = scan_msgpack_skip_or_error(p, end);
+		entries[i].index = i;
+		p = scan_msgpack_skip_or_error(entries[i].val, end);
+	}
+
+	/* the buffer may have moved while growing */
+	for (i = 0; i < map->size; ++i)
+		entries[i].ckey = keybuf.data + entries[i].ckey_offset;
+
+	/* equal keys stay in source order, so the last one of a run wins */
+	qsort(entries, map->size, sizeof(MapEntryData), map_entry_cmp);
+
+	nunique = 1;
+	for (i = 1; i < map->size; ++i) {
+		if (key_cmp(&entries[i - 1], &entries[i]) != 0)
+			nunique++;
+	}
+
+	msgpack_pack_map(pk, nunique);
+
+	for (i = 0; i < map->size; ++i) {
+		if (i + 1 < map->size && key_cmp(&entries[i], &entries[i + 1]) == 0)
+			continue;
+
+		(* pk->callback)(pk->data, entries[i].ckey, entries[i].ckey_len);
+		canonicalize_value(pk, entries[i].val, end, narrow_floats);
+	}
+
+	msgpack_sbuffer_destroy(&keybuf);
+	pfree(entries);
+}
+
+static int
+map_entry_cmp(const void *a, const void *b)
+{
+	const MapEntryData	*ea = (const MapEntryData *) a;
+	const MapEntryData	*eb = (const MapEntryData *) b;
+	int					cmp;
+
+	cmp = key_cmp(ea, eb);
+	if (cmp != 0)
+		return cmp;
+
+	return ea->index < eb->index ? -1 : 1;
+}
+
+static int
+key_cmp(const MapEntryData *a, const MapEntryData *b)
+{
+	const char	*pa;
+	const char	*pb;
+	uint32		la;
+	uint32		lb;
+
+	/* raw keys sort by their bytes and come before any other key */
+	if (a->key.type == SCAN_MSGPACK_RAW && b->key.type == SCAN_MSGPACK_RAW) {
+		pa = a->key.body;
+		la = a->key.size;
+		pb = b->key.body;
+		lb = b->key.size;
+	} else if (a->key.type == SCAN_MSGPACK_RAW) {
+		return -1;
+	} else if (b->key.type == SCAN_MSGPACK_RAW) {
+		return 1;
+	} else {
+		/* other keys sort by their canonical encoding */
+		pa = a->ckey;
+		la = a->ckey_len;
+		pb = b->ckey;
+		lb = b->ckey_len;
+	}
+
+	return scan_msgpack_raw_cmp(pa, la, pb, lb);
+}
@@ -0,0 +1,8 @@
+#ifndef __PG_MSGPACK_CANONICAL_H__
+#define __PG_MSGPACK_CANONICAL_H__
+
+#include "fmgr.h"
+
+Datum msgpack_canonicalize(PG_FUNCTION_ARGS);
+
+#endif /* __PG_MSGPACK_CANONICAL_H__ */
@@ -0,0 +1,491 @@
+#include "postgres.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+
+#include "pg_msgpack_delta.h"
+#include "scan_msgpack.h"
+
+PG_FUNCTION_INFO_V1(msgpack_diff);
+PG_FUNCTION_INFO_V1(msgpack_patch);
+
+/*
+ * A delta is a msgpack array of operations applied in order:
+ *
+ *   [path, value]  set the value at path, adding the last key if missing
+ *   [path]         delete the entry at path
+ *
+ * A path is an array of map keys from the top level; the empty path is the
+ * whole document. Values are embedded as they are, so msgpack_out can print
+ * a delta like any other document.
+ */
+
+/*
+ * An entry of a map being compared
+ */
+typedef struct {
+	const char	*key_start;	/* header of the key */
+	const char	*key;
+	uint32		keylen;
+	const char	*val;
+	const char	*end;
+	uint32		index;	/* position in the map */
+} DeltaEntryData, *DeltaEntry;
+
+/*
+ * Keys from the top level down to the value being compared
+ */
+typedef struct {
+	const char	**keys;
+	uint32		*keylens;
+	int			depth;
+	int			maxdepth;
+} DeltaPathData, *DeltaPath;
+
+/*
+ * State for msgpack_diff
+ */
+typedef struct {
+	DeltaPathData	path;
+	StringInfoData	ops;
+	uint32			nops;
+} DiffStateData, *DiffState;
+
+/*
+ * private functions
+ */
+static void diff_value(DiffState state, const char *old, const char *old_end,
+		const char *new, const char *new_end);
+static bool diff_map(DiffState state, const ScanMsgpackHeader old_map, const char *old_end,
+		const ScanMsgpackHeader new_map, const char *new_end);
+static DeltaEntry collect_entries(const ScanMsgpackHeader map, const char *end);
+static bool has_duplicate_keys(DeltaEntry entries, uint32 n);
+static DeltaEntry find_entry(DeltaEntry sorted, uint32 n, const char *key, uint32 keylen);
+static void push_key(DeltaPath path, const char *key, uint32 keylen);
+static void add_op(DiffState state, const char *val, const char *val_end);
+static bytea * apply_op(const char *doc, const char *doc_end, const char *op,
+		const char *op_end);
+static int delta_entry_cmp(const void *a, const void *b);
+static bool is_narrowest_header(const char *start, const char *body,
+		ScanMsgpackType type, uint32 n);
+static void invalid_delta(void) pg_attribute_noreturn();
+
+
+Datum
+msgpack_diff(PG_FUNCTION_ARGS)
+{
+	bytea			*old = PG_GETARG_BYTEA_P(0);
+	bytea			*new = PG_GETARG_BYTEA_P(1);
+	const char		*old_start = VARDATA(old);
+	const char		*new_start = VARDATA(new);
+	size_t			new_size = VARSIZE(new) - VARHDRSZ;
+	DiffStateData	state;
+	StringInfoData	out;
+
+	memset(&state, 0, sizeof(DiffStateData));
+	initStringInfo(&state.ops);
+
+	diff_value(&state, old_start, old_start + VARSIZE(old) - VARHDRSZ,
+			new_start, new_start + new_size);
+
+	/* a delta larger than the document is replaced by the document itself */
+	if ((size_t) state.ops.len > new_size + 2) {
+		resetStringInfo(&state.ops);
+		state.nops = 0;
+		state.path.depth = 0;
+		add_op(&state, new_start, new_start + new_size);
+	}
+
+	initStringInfo(&out);
+	appendStringInfoSpaces(&out, VARHDRSZ);
+	scan_msgpack_append_header(&out, SCAN_MSGPACK_ARRAY, state.nops);
+	appendBinaryStringInfo(&out, state.ops.data, state.ops.len);
+	SET_VARSIZE(out.data, out.len);
+
+	PG_RETURN_BYTEA_P((bytea *) out.data);
+}
+
+Datum
+msgpack_patch(PG_FUNCTION_ARGS)
+{
+	bytea					*base = PG_GETARG_BYTEA_P(0);
+	bytea					*delta = PG_GETARG_BYTEA_P(1);
+	bytea					*doc = base;
+	bytea					*next;
+	const char				*p = VARDATA(delta);
+	const char				*end = p + VARSIZE(delta) - VARHDRSZ;
+	const char				*op_end;
+	ScanMsgpackHeaderData	ops;
+	uint32					i;
+
+	if (!scan_msgpack_header(p, end, &ops) || ops.type != SCAN_MSGPACK_ARRAY)
+		invalid_delta();
+
+	/* each operation splices the bytes of the document produced so far */
+	p = ops.body;
+	for (i = 0; i < ops.size; ++i) {
+		if ((op_end = scan_msgpack_skip(p, end)) == NULL)
+			invalid_delta();
+
+		next = apply_op(VARDATA(doc), VARDATA(doc) + VARSIZE(doc) - VARHDRSZ, p, op_end);
+		if (doc != base)
+			pfree(doc);
+		doc = next;
+		p = op_end;
+	}
+
+	PG_RETURN_BYTEA_P(doc);
+}
+
+/*
+ * private functions
+ */
+static void
+diff_value(DiffState state, const char *old, const char *old_end,
+		const char *new, const char *new_end)
+{
+	ScanMsgpackHeaderData	old_header;
+	ScanMsgpackHeaderData	new_header;
+
+	check_stack_depth();
+
+	old_end = scan_msgpack_skip_or_error(old, old_end);
+	new_end = scan_msgpack_skip_or_error(new, new_end);
+
+	if (old_end - old == new_end - new && memcmp(old, new, new_end - new) == 0)
+		return;
+
+	/* maps are compared by key; anything else is replaced as a whole */
+	if (scan_msgpack_header(old, old_end, &old_header) &&
+			scan_msgpack_header(new, new_end, &new_header) &&
+			old_header.type == SCAN_MSGPACK_MAP &&
+			new_header.type == SCAN_MSGPACK_MAP &&
+			diff_map(state, &old_header, old_end, &new_header, new_end))
+		return;
+
+	add_op(state, new, new_end);
+}
+
+/*
+ * Add the operations turning one map into the other. Returns false, adding
+ * nothing, if patching could not reproduce the new map byte for byte: when
+ * a key is not raw or appears twice, when the keys kept from the old map
+ * change order or do not all come before the added ones, or when a map header
+ * or the header of an added key is not the narrowest one, which is what
+ * patching writes.
+ */
+static bool
+diff_map(DiffState state, const ScanMsgpackHeader old_map, const char *old_end,
+		const ScanMsgpackHeader new_map, const char *new_end)
+{
+	DeltaEntry		old_entries;
+	DeltaEntry		new_entries;
+	DeltaEntry		sorted;
+	DeltaEntry		new_sorted;
+	DeltaEntry		found;
+	int				last = -1;
+	bool			added = false;
+	uint32			i;
+
+	/* a header kept from the old map must already be what the new map has */
+	if (!is_narrowest_header(old_map->start, old_map->body,
+				SCAN_MSGPACK_MAP, old_map->size) ||
+			!is_narrowest_header(new_map->start, new_map->body,
+				SCAN_MSGPACK_MAP, new_map->size))
+		return false;
+
+	if ((old_entries = collect_entries(old_map, old_end)) == NULL ||
+			(new_entries = collect_entries(new_map, new_end)) == NULL)
+		return false;
+
+	/* sorted copies for lookups; the entries stay in map order */
+	sorted = palloc(sizeof(DeltaEntryData) * (old_map->size + 1));
+	memcpy(sorted, old_entries, sizeof(DeltaEntryData) * old_map->size);
+	qsort(sorted, old_map->size, sizeof(DeltaEntryData), delta_entry_cmp);
+
+	new_sorted = palloc(sizeof(DeltaEntryData) * (new_map->size + 1));
+	memcpy(new_sorted, new_entries, sizeof(DeltaEntryData) * new_map->size);
+	qsort(new_sorted, new_map->size, sizeof(DeltaEntryData), delta_entry_cmp);
+
+	if (has_duplicate_keys(sorted, old_map->size) ||
+			has_duplicate_keys(new_sorted, new_map->size))
+		return false;
+
+	/* patching keeps the order of the old map and appends new keys */
+	for (i = 0; i < new_map->size; ++i) {
+		found = find_entry(sorted, old_map->size, new_entries[i].key, new_entries[i].keylen);
+		if (found == NULL) {
+			if (!is_narrowest_header(new_entries[i].key_start, new_entries[i].key,
+						SCAN_MSGPACK_RAW, new_entries[i].keylen))
+				return false;
+			added = true;
+		} else {
+			if (added || (int) found->index < last)
+				return false;
+			last = found->index;
+		}
+	}
+
+	/* deleted keys */
+	for (i = 0; i < old_map->size; ++i) {
+		if (find_entry(new_sorted, new_map->size,
+					old_entries[i].key, old_entries[i].keylen) != NULL)
+			continue;
+		push_key(&state->path, old_entries[i].key, old_entries[i].keylen);
+		add_op(state, NULL, NULL);
+		state->path.depth--;
+	}
+
+	/* changed and added keys, in the order of the new map */
+	for (i = 0; i < new_map->size; ++i) {
+		found = find_entry(sorted, old_map->size, new_entries[i].key, new_entries[i].keylen);
+		push_key(&state->path, new_entries[i].key, new_entries[i].keylen);
+		if (found == NULL)
+			add_op(state, new_entries[i].val, new_entries[i].end);
+		else
+			diff_value(state, found->val, found->end, new_entries[i].val, new_entries[i].end);
+		state->path.depth--;
+	}
+
+	return true;
+}
+
+/*
+ * Collect the entries of a map in order, or NULL if a key is not raw
+ */
+static DeltaEntry
+collect_entries(const ScanMsgpackHeader map, const char *end)
+{
+	DeltaEntry				entries = palloc(sizeof(DeltaEntryData) * (map->size + 1));
+	ScanMsgpackHeaderData	key;
+	const char				*p = map->body;
+	uint32					i;
+
+	for (i = 0; i < map->size; ++i) {
+		if (!scan_msgpack_header(p, end, &key))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid msgpack value")));
+		if (key.type != SCAN_MSGPACK_RAW)
+			return NULL;
+
+		entries[i].key_start = p;
+		entries[i].key = key.body;
+		entries[i].keylen = key.size;
+		entries[i].val = key.body + key.size;
+		entries[i].end = scan_msgpack_skip_or_error(entries[i].val, end);
+		entries[i].index = i;
+		p = entries[i].end;
+	}
+
+	return entries;
+}
+
+static bool
+has_duplicate_keys(DeltaEntry sorted, uint32 n)
+{
+	uint32 i;
+
+	for (i = 1; i < n; ++i) {
+		if (scan_msgpack_raw_cmp(sorted[i - 1].key, sorted[i - 1].keylen,
+					sorted[i].key, sorted[i].keylen) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static DeltaEntry
+find_entry(DeltaEntry sorted, uint32 n, const char *key, uint32 keylen)
+{
+	DeltaEntryData probe;
+
+	probe.key = key;
+	probe.keylen = keylen;
+
+	return (DeltaEntry) bsearch(&probe, sorted, n, sizeof(DeltaEntryData), delta_entry_cmp);
+}
+
+static void
+push_key(DeltaPath path, const char *key, uint32 keylen)
+{
+	if (path->depth == path->maxdepth) {
+		path->maxdepth = Max(path->maxdepth * 2, 8);
+		if (path->keys == NULL) {
+			path->keys = palloc(sizeof(char *) * path->maxdepth);
+			path->keylens = palloc(sizeof(uint32) * path->maxdepth);
+		} else {
+			path->keys = repalloc(path->keys, sizeof(char *) * path->maxdepth);
+			path->keylens = repalloc(path->keylens, sizeof(uint32) * path->maxdepth);
+		}
+	}
+
+	path->keys[path->depth] = key;
+	path->keylens[path->depth] = keylen;
+	path->depth++;
+}
+
+/*
+ * Add a set operation for the current path, or a delete when val is NULL
+ */
+static void
+add_op(DiffState state, const char *val, const char *val_end)
+{
+	int i;
+
+	appendStringInfoChar(&state->ops, (char) (val != NULL ? 0x92 : 0x91));
+
+	scan_msgpack_append_header(&state->ops, SCAN_MSGPACK_ARRAY, state->path.depth);
+	for (i = 0; i < state->path.depth; ++i) {
+		scan_msgpack_append_header(&state->ops, SCAN_MSGPACK_RAW, state->path.keylens[i]);
+		appendBinaryStringInfo(&state->ops, state->path.keys[i], state->path.keylens[i]);
+	}
+
+	if (val != NULL)
+		appendBinaryStringInfo(&state->ops, val, val_end - val);
+
+	state->nops++;
+}
+
+/*
+ * Apply one operation to a document and return the result as a new bytea
+ */
+static bytea *
+apply_op(const char *doc, const char *doc_end, const char *op, const char *op_end)
+{
+	ScanMsgpackHeaderData	header;
+	ScanMsgpackHeaderData	path;
+	ScanMsgpackHeaderData	key;
+	ScanMsgpackHeaderData	map;
+	ScanMsgpackHeaderData	entry_key;
+	StringInfoData			out;
+	const char				*val = NULL;
+	const char				*p;
+	const char				*target = doc;
+	const char				*target_end = doc_end;
+	const char				*entry = NULL;
+	const char				*entry_end = NULL;
+	const char				*k;
+	const char				*v;
+	uint32					depth;
+	uint32					i;
+	uint32					j;
+
+	if (!scan_msgpack_header(op, op_end, &header) || header.type != SCAN_MSGPACK_ARRAY ||
+			header.size < 1 || header.size > 2 ||
+			!scan_msgpack_header(header.body, op_end, &path) ||
+			path.type != SCAN_MSGPACK_ARRAY)
+		invalid_delta();
+
+	if (header.size == 2)
+		val = scan_msgpack_skip_or_error(header.body, op_end);
+
+	/* walk down the path; the last key is looked up in the last map */
+	k = path.body;
+	for (depth = 0; depth < path.size; ++depth) {
+		if (!scan_msgpack_header(k, op_end, &key) || key.type != SCAN_MSGPACK_RAW)
+			invalid_delta();
+
+		if (!scan_msgpack_header(target, target_end, &map) || map.type != SCAN_MSGPACK_MAP)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("msgpack delta does not apply to the base document")));
+
+		entry = NULL;
+		p = map.body;
+		for (i = 0; i < map.size; ++i) {
+			const char *entry_start = p;
+
+			v = scan_msgpack_skip_or_error(p, target_end);
+			p = scan_msgpack_skip_or_error(v, target_end);
+
+			if (scan_msgpack_header(entry_start, v, &entry_key) &&
+					entry_key.type == SCAN_MSGPACK_RAW && entry_key.size == key.size &&
+					memcmp(entry_key.body, key.body, key.size) == 0) {
+				entry = entry_start;
+				entry_end = p;
+				break;
+			}
+		}
+
+		k = key.body + key.size;
+
+		if (depth + 1 < path.size) {
+			if (entry == NULL)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("msgpack delta does not apply to the base document")));
+			target = scan_msgpack_skip_or_error(entry, entry_end);
+			target_end = entry_end;
+		}
+	}
+
+	initStringInfo(&out);
+	appendStringInfoSpaces(&out, VARHDRSZ);
+
+	if (path.size == 0) {
+		/* the whole document */
+		if (val == NULL)
+			invalid_delta();
+		appendBinaryStringInfo(&out, val, op_end - val);
+	} else if (entry != NULL && val != NULL) {
+		/* replace the value in place */
+		v = scan_msgpack_skip_or_error(entry, entry_end);
+		appendBinaryStringInfo(&out, doc, v - doc);
+		appendBinaryStringInfo(&out, val, op_end - val);
+		appendBinaryStringInfo(&out, entry_end, doc_end - entry_end);
+	} else if (entry != NULL || val != NULL) {
+		/* the number of entries changes, so the map header is rewritten */
+		j = entry != NULL ? map.size - 1 : map.size + 1;
+		appendBinaryStringInfo(&out, doc, map.start - doc);
+		scan_msgpack_append_header(&out, SCAN_MSGPACK_MAP, j);
+		if (entry != NULL) {
+			appendBinaryStringInfo(&out, map.body, entry - map.body);
+			appendBinaryStringInfo(&out, entry_end, doc_end - entry_end);
+		} else {
+			p = scan_msgpack_skip_or_error(target, target_end);
+			appendBinaryStringInfo(&out, map.body, p - map.body);
+			scan_msgpack_append_header(&out, SCAN_MSGPACK_RAW, key.size);
+			appendBinaryStringInfo(&out, key.body, key.size);
+			appendBinaryStringInfo(&out, val, op_end - val);
+			appendBinaryStringInfo(&out, p, doc_end - p);
+		}
+	} else {
+		/* deleting a missing key changes nothing */
+		appendBinaryStringInfo(&out, doc, doc_end - doc);
+	}
+
+	SET_VARSIZE(out.data, out.len);
+
+	return (bytea *) out.data;
+}
+
+static int
+delta_entry_cmp(const void *a, const void *b)
+{
+	const DeltaEntryData *ea = (const DeltaEntryData *) a;
+	const DeltaEntryData *eb = (const DeltaEntryData *) b;
+
+	return scan_msgpack_raw_cmp(ea->key, ea->keylen, eb->key, eb->keylen);
+}
+
+/*
+ * Whether the header from start to body is the narrowest one, which is what
+ * patching writes
+ */
+static bool
+is_narrowest_header(const char *start, const char *body, ScanMsgpackType type, uint32 n)
+{
+	char	header[SCAN_MSGPACK_MAX_HEADER_SIZE];
+	char	*header_end = scan_msgpack_write_header(header, type, n);
+
+	return header_end - header == body - start &&
+		memcmp(header, start, body - start) == 0;
+}
+
+static void
+invalid_delta(void)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			 errmsg("invalid msgpack delta")));
+}
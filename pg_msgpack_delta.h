@@ -0,0 +1,9 @@
+#ifndef __PG_MSGPACK_DELTA_H__
+#define __PG_MSGPACK_DELTA_H__
+
+#include "fmgr.h"
+
+Datum msgpack_diff(PG_FUNCTION_ARGS);
+Datum msgpack_patch(PG_FUNCTION_ARGS);
+
+#endif /* __PG_MSGPACK_DELTA_H__ */
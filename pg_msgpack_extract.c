@@ -0,0 +1,316 @@
+#include "postgres.h"
+#include "catalog/pg_type.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+
+#include "pg_msgpack_extract.h"
+#include "scan_msgpack.h"
+
+PG_FUNCTION_INFO_V1(msgpack_extract_keys);
+PG_FUNCTION_INFO_V1(msgpack_extract_values);
+
+/*
+ * A requested key
+ */
+typedef struct {
+	char	*key;
+	uint32	keylen;
+} ExtractKeyData;
+
+/*
+ * Requested keys of a call site, kept in fn_extra
+ */
+typedef struct {
+	/* copy of the keys array the cache was built from */
+	ArrayType		*source;
+
+	/* distinct non-null keys in bytewise order */
+	ExtractKeyData	*keys;
+	int				nkeys;
+
+	/* index into keys of each element of the array; -1 for nulls */
+	int				*order;
+	int				norder;
+
+	/* element type of the result of msgpack_extract_values */
+	Oid				elemtype;
+	int16			elemlen;
+	bool			elembyval;
+	char			elemalign;
+} ExtractCacheData, *ExtractCache;
+
+/*
+ * Range of encoded bytes
+ */
+typedef struct {
+	const char	*start;
+	const char	*end;
+} ExtractRange;
+
+/*
+ * private functions
+ */
+static ExtractCache get_extract_cache(FunctionCallInfo fcinfo, ArrayType *keys);
+static int scan_map(const char *p, const char *end, ExtractCache cache,
+		ExtractRange *keys, ExtractRange *vals, int *found);
+static int find_key(ExtractCache cache, const char *key, uint32 keylen);
+static int extract_key_cmp(const void *a, const void *b);
+
+
+Datum
+msgpack_extract_keys(PG_FUNCTION_ARGS)
+{
+	bytea			*data = PG_GETARG_BYTEA_P(0);
+	ExtractCache	cache = get_extract_cache(fcinfo, PG_GETARG_ARRAYTYPE_P(1));
+	const char		*start = VARDATA(data);
+	const char		*end = start + VARSIZE(data) - VARHDRSZ;
+	ExtractRange	*keys = palloc(sizeof(ExtractRange) * (cache->nkeys + 1));
+	ExtractRange	*vals = palloc(sizeof(ExtractRange) * (cache->nkeys + 1));
+	int				*found = palloc(sizeof(int) * (cache->nkeys + 1));
+	bytea			*result;
+	size_t			size;
+	char			*p;
+	int				nfound;
+	int				i;
+
+	if ((nfound = scan_map(start, end, cache, keys, vals, found)) < 0)
+		PG_RETURN_NULL();
+
+	size = SCAN_MSGPACK_MAX_HEADER_SIZE;
+	for (i = 0; i < nfound; ++i)
+		size += vals[found[i]].end - keys[found[i]].start;
+
+	result = (bytea *) palloc(size + VARHDRSZ);
+	p = VARDATA(result);
+
+	p = scan_msgpack_write_header(p, SCAN_MSGPACK_MAP, nfound);
+
+	/* matching entries are copied as they are, in document order */
+	for (i = 0; i < nfound; ++i) {
+		size = vals[found[i]].end - keys[found[i]].start;
+		memcpy(p, keys[found[i]].start, size);
+		p += size;
+	}
+
+	SET_VARSIZE(result, p - (char *) result);
+
+	PG_RETURN_BYTEA_P(result);
+}
+
+Datum
+msgpack_extract_values(PG_FUNCTION_ARGS)
+{
+	bytea			*data = PG_GETARG_BYTEA_P(0);
+	ExtractCache	cache = get_extract_cache(fcinfo, PG_GETARG_ARRAYTYPE_P(1));
+	const char		*start = VARDATA(data);
+	const char		*end = start + VARSIZE(data) - VARHDRSZ;
+	ExtractRange	*keys = palloc(sizeof(ExtractRange) * (cache->nkeys + 1));
+	ExtractRange	*vals = palloc(sizeof(ExtractRange) * (cache->nkeys + 1));
+	Datum			*elems;
+	bool			*nulls;
+	int				dims[1];
+	int				lbs[1];
+	int				i;
+
+	if (scan_map(start, end, cache, keys, vals, NULL) < 0)
+		PG_RETURN_NULL();
+
+	if (!OidIsValid(cache->elemtype))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("could not determine the element type of the result")));
+
+	if (cache->norder == 0)
+		PG_RETURN_ARRAYTYPE_P(construct_empty_array(cache->elemtype));
+
+	elems = palloc(sizeof(Datum) * cache->norder);
+	nulls = palloc(sizeof(bool) * cache->norder);
+
+	/* values follow the order of the requested keys */
+	for (i = 0; i < cache->norder; ++i) {
+		int k = cache->order[i];
+
+		nulls[i] = k < 0 || keys[k].start == NULL;
+		elems[i] = nulls[i] ? (Datum) 0 :
+			PointerGetDatum(scan_msgpack_to_bytea(vals[k].start, vals[k].end));
+	}
+
+	dims[0] = cache->norder;
+	lbs[0] = 1;
+
+	PG_RETURN_ARRAYTYPE_P(construct_md_array(elems, nulls, 1, dims, lbs,
+				cache->elemtype, cache->elemlen, cache->elembyval, cache->elemalign));
+}
+
+/*
+ * private functions
+ */
+static ExtractCache
+get_extract_cache(FunctionCallInfo fcinfo, ArrayType *keys)
+{
+	ExtractCache	cache = (ExtractCache) fcinfo->flinfo->fn_extra;
+	MemoryContext	oldcontext;
+	Datum			*elems;
+	bool			*nulls;
+	int				nelems;
+	int				i;
+	int				j;
+
+	/* the keys are usually a constant, so compare the bytes before rebuilding */
+	if (cache != NULL &&
+			VARSIZE(cache->source) == VARSIZE(keys) &&
+			memcmp(cache->source, keys, VARSIZE(keys)) == 0)
+		return cache;
+
+	if (ARR_ELEMTYPE(keys) != TEXTOID)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("keys must be a text array")));
+
+	oldcontext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+
+	if (cache == NULL) {
+		Oid rettype = get_fn_expr_rettype(fcinfo->flinfo);
+
+		cache = palloc0(sizeof(ExtractCacheData));
+
+		/* msgpack has no fixed oid; take it from msgpack[] */
+		if (OidIsValid(rettype) && OidIsValid(get_element_type(rettype))) {
+			cache->elemtype = get_element_type(rettype);
+			get_typlenbyvalalign(cache->elemtype,
+					&cache->elemlen, &cache->elembyval, &cache->elemalign);
+		}
+
+		fcinfo->flinfo->fn_extra = cache;
+	} else {
+		pfree(cache->source);
+		pfree(cache->keys);
+		pfree(cache->order);
+	}
+
+	cache->source = palloc(VARSIZE(keys));
+	memcpy(cache->source, keys, VARSIZE(keys));
+
+	deconstruct_array(cache->source, TEXTOID, -1, false, 'i', &elems, &nulls, &nelems);
+
+	cache->keys = palloc(sizeof(ExtractKeyData) * (nelems + 1));
+	cache->nkeys = 0;
+	for (i = 0; i < nelems; ++i) {
+		if (nulls[i])
+			continue;
+
+		cache->keys[cache->nkeys].key = VARDATA_ANY(DatumGetPointer(elems[i]));
+		cache->keys[cache->nkeys].keylen = VARSIZE_ANY_EXHDR(DatumGetPointer(elems[i]));
+		cache->nkeys++;
+	}
+
+	qsort(cache->keys, cache->nkeys, sizeof(ExtractKeyData), extract_key_cmp);
+
+	/* a key requested twice is looked for once */
+	for (i = 0, j = 0; i < cache->nkeys; ++i) {
+		if (j > 0 && extract_key_cmp(&cache->keys[j - 1], &cache->keys[i]) == 0)
+			continue;
+		cache->keys[j++] = cache->keys[i];
+	}
+	cache->nkeys = j;
+
+	cache->order = palloc(sizeof(int) * (nelems + 1));
+	cache->norder = nelems;
+	for (i = 0; i < nelems; ++i) {
+		cache->order[i] = nulls[i] ? -1 :
+			find_key(cache,
+					VARDATA_ANY(DatumGetPointer(elems[i])),
+					VARSIZE_ANY_EXHDR(DatumGetPointer(elems[i])));
+	}
+
+	pfree(elems);
+	pfree(nulls);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return cache;
+}
+
+/*
+ * Scan the top-level map once, setting the ranges of the first entry of each
+ * requested key; keys not found get a NULL start. The keys found are listed
+ * in document order in found, if given. Returns the number of keys found, or
+ * -1 if the value is not a map.
+ */
+static int
+scan_map(const char *p, const char *end, ExtractCache cache,
+		ExtractRange *keys, ExtractRange *vals, int *found)
+{
+	ScanMsgpackHeaderData	map;
+	ScanMsgpackHeaderData	k;
+	const char				*v;
+	int						nfound = 0;
+	int						idx;
+	uint32					i;
+
+	if (!scan_msgpack_header(p, end, &map) || map.type != SCAN_MSGPACK_MAP)
+		return -1;
+
+	for (idx = 0; idx < cache->nkeys; ++idx)
+		keys[idx].start = NULL;
+
+	/* stop as soon as every key has been seen */
+	p = map.body;
+	for (i = 0; i < map.size && nfound < cache->nkeys; ++i) {
+		if (!scan_msgpack_header(p, end, &k))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid msgpack value")));
+
+		if (k.type == SCAN_MSGPACK_RAW)
+			v = k.body + k.size;
+		else
+			v = scan_msgpack_skip_or_error(p, end);
+
+		p = scan_msgpack_skip_or_error(v, end);
+
+		if (k.type == SCAN_MSGPACK_RAW &&
+				(idx = find_key(cache, k.body, k.size)) >= 0 &&
+				keys[idx].start == NULL) {
+			keys[idx].start = k.start;
+			vals[idx].start = v;
+			vals[idx].end = p;
+			if (found != NULL)
+				found[nfound] = idx;
+			nfound++;
+		}
+	}
+
+	return nfound;
+}
+
+static int
+find_key(ExtractCache cache, const char *key, uint32 keylen)
+{
+	int lo = 0;
+	int hi = cache->nkeys - 1;
+
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+		int cmp = scan_msgpack_raw_cmp(cache->keys[mid].key, cache->keys[mid].keylen, key, keylen);
+
+		if (cmp == 0)
+			return mid;
+		else if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return -1;
+}
+
+static int
+extract_key_cmp(const void *a, const void *b)
+{
+	const ExtractKeyData *ka = (const ExtractKeyData *) a;
+	const ExtractKeyData *kb = (const ExtractKeyData *) b;
+
+	return scan_msgpack_raw_cmp(ka->key, ka->keylen, kb->key, kb->keylen);
+}
@@ -0,0 +1,9 @@
+#ifndef __PG_MSGPACK_EXTRACT_H__
+#define __PG_MSGPACK_EXTRACT_H__
+
+#include "fmgr.h"
+
+Datum msgpack_extract_keys(PG_FUNCTION_ARGS);
+Datum msgpack_extract_values(PG_FUNCTION_ARGS);
+
+#endif /* __PG_MSGPACK_EXTRACT_H__ */
@@ -1,88 +1,102 @@
-#include <msgpack.h>
-
 #include "postgres.h"
 #include "utils/builtins.h"
 
 #include "pg_msgpack_op.h"
-#include "convert_from_msgpack.h"
+#include "expanded_msgpack.h"
+#include "scan_msgpack.h"
 
 PG_FUNCTION_INFO_V1(msgpack_object_field);
 PG_FUNCTION_INFO_V1(msgpack_array_element);
+PG_FUNCTION_INFO_V1(msgpack_exists);
 
 Datum
 msgpack_object_field(PG_FUNCTION_ARGS)
 {
-	bytea			*data = PG_GETARG_BYTEA_P(0);
-	bytea			*result = NULL;
-	text			*fname = PG_GETARG_TEXT_P(1);
-	const char		*fnamestr = text_to_cstring(fname);
-
-	bool				success;
-	msgpack_unpacked	msg;
-	msgpack_object_kv	*p;
-	msgpack_object_kv	*pend;
-
-	msgpack_unpacked_init(&msg);
-	success = msgpack_unpack_next(&msg, VARDATA(data), VARSIZE(data) - VARHDRSZ, NULL);
-
-	if (!success)
-		PG_RETURN_NULL();
-
-	if (msg.data.type != MSGPACK_OBJECT_MAP || msg.data.via.map.size == 0)
-		PG_RETURN_NULL();
-
-	p = msg.data.via.map.ptr;
-	pend = p + msg.data.via.map.size;
-
-	for (; p < pend; ++p) {
-		if (p->key.type != MSGPACK_OBJECT_RAW)
-			continue;
-
-		if (p->key.via.raw.size == strlen(fnamestr) &&
-				memcmp(p->key.via.raw.ptr, fnamestr, p->key.via.raw.size) == 0) {
-			result = msgpack_to_bytea(p->val);
-			break;
-		}
+	bytea		*data;
+	text		*fname = PG_GETARG_TEXT_P(1);
+	const char	*start;
+	const char	*end;
+	const char	*val_start;
+	const char	*val_end;
+	uint32		vallen;
+
+	/* an expanded map is looked up through its index, without flattening */
+	if (datum_is_expanded_msgpack(PG_GETARG_DATUM(0))) {
+		if (!expanded_msgpack_lookup(DatumGetExpandedMsgpack(PG_GETARG_DATUM(0)),
+					VARDATA(fname), VARSIZE(fname) - VARHDRSZ,
+					&val_start, &vallen))
+			PG_RETURN_NULL();
+
+		PG_RETURN_BYTEA_P(scan_msgpack_to_bytea(val_start, val_start + vallen));
 	}
 
-	msgpack_unpacked_destroy(&msg);
+	data = PG_GETARG_BYTEA_P(0);
+	start = VARDATA(data);
+	end = start + VARSIZE(data) - VARHDRSZ;
 
-	if (result != NULL)
-		PG_RETURN_BYTEA_P(result);
-	else
+	/* the value is copied as it is, without unpacking the map */
+	if (!scan_msgpack_map_lookup(start, end,
+				VARDATA(fname), VARSIZE(fname) - VARHDRSZ,
+				&val_start, &val_end))
 		PG_RETURN_NULL();
+
+	PG_RETURN_BYTEA_P(scan_msgpack_to_bytea(val_start, val_end));
 }
 
 
 Datum
 msgpack_array_element(PG_FUNCTION_ARGS)
 {
-	bytea	   	*data = PG_GETARG_BYTEA_P(0);
-	bytea	   	*result;
+	bytea		*data = PG_GETARG_BYTEA_P(0);
 	int			element = PG_GETARG_INT32(1);
+	const char	*p = VARDATA(data);
+	const char	*end = p + VARSIZE(data) - VARHDRSZ;
+	int			i;
 
-	bool 				success;
-	msgpack_unpacked 	msg;
-	msgpack_object 		*target;
-
-	msgpack_unpacked_init(&msg);
-	success = msgpack_unpack_next(&msg, VARDATA(data), VARSIZE(data) - VARHDRSZ, NULL);
+	ScanMsgpackHeaderData	array;
 
-	if (!success)
+	if (!scan_msgpack_header(p, end, &array))
 		PG_RETURN_NULL();
 
-	if (msg.data.type != MSGPACK_OBJECT_ARRAY ||
-			msg.data.via.array.size == 0 ||
-			element >= msg.data.via.array.size)
+	if (array.type != SCAN_MSGPACK_ARRAY ||
+			element < 0 ||
+			(uint32) element >= array.size)
 		PG_RETURN_NULL();
 
-	target = msg.data.via.array.ptr + element;
-	result = msgpack_to_bytea(*target);
-
-	msgpack_unpacked_destroy(&msg);
+	/* elements are variable length, so skip over the preceding ones */
+	p = array.body;
+	for (i = 0; i < element; ++i) {
+		if ((p = scan_msgpack_skip(p, end)) == NULL)
+			PG_RETURN_NULL();
+	}
 
-	if (result != NULL)
-		PG_RETURN_BYTEA_P(result);
-	else
+	if ((end = scan_msgpack_skip(p, end)) == NULL)
 		PG_RETURN_NULL();
+
+	PG_RETURN_BYTEA_P(scan_msgpack_to_bytea(p, end));
+}
+
+Datum
+msgpack_exists(PG_FUNCTION_ARGS)
+{
+	bytea		*data;
+	text		*key = PG_GETARG_TEXT_P(1);
+	const char	*start;
+	const char	*end;
+	const char	*val_start;
+	const char	*val_end;
+	uint32		vallen;
+
+	if (datum_is_expanded_msgpack(PG_GETARG_DATUM(0)))
+		PG_RETURN_BOOL(expanded_msgpack_lookup(DatumGetExpandedMsgpack(PG_GETARG_DATUM(0)),
+					VARDATA(key), VARSIZE(key) - VARHDRSZ,
+					&val_start, &vallen));
+
+	data = PG_GETARG_BYTEA_P(0);
+	start = VARDATA(data);
+	end = start + VARSIZE(data) - VARHDRSZ;
+
+	PG_RETURN_BOOL(scan_msgpack_map_lookup(start, end,
+				VARDATA(key), VARSIZE(key) - VARHDRSZ,
+				&val_start, &val_end));
 }
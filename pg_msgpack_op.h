@@ -5,5 +5,6 @@
 
 Datum msgpack_object_field(PG_FUNCTION_ARGS);
 Datum msgpack_array_element(PG_FUNCTION_ARGS);
+Datum msgpack_exists(PG_FUNCTION_ARGS);
 
 #endif /* __PG_MSGPACK_OP_H__ */
@@ -0,0 +1,841 @@
+#include <math.h>
+#include <msgpack.h>
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "utils/builtins.h"
+#include "utils/jsonpath.h"
+
+#include "pg_msgpack_path.h"
+#include "scan_msgpack.h"
+
+PG_FUNCTION_INFO_V1(msgpack_path_exists);
+PG_FUNCTION_INFO_V1(msgpack_path_match);
+PG_FUNCTION_INFO_V1(msgpack_path_match_opr);
+PG_FUNCTION_INFO_V1(msgpack_path_query);
+
+/*
+ * A value found by the evaluator. Values from the document are byte ranges
+ * into it; literals from the path are encoded into msgpack so that both are
+ * handled alike.
+ */
+typedef struct {
+	const char	*start;
+	const char	*end;
+} PathValueData, *PathValue;
+
+/*
+ * Result of a predicate, as in SQL/JSON
+ */
+typedef enum {
+	PATH_BOOL_FALSE,
+	PATH_BOOL_TRUE,
+	PATH_BOOL_UNKNOWN
+} PathBool;
+
+/*
+ * State for the evaluator
+ */
+typedef struct {
+	PathValueData	root;		/* $ */
+	PathValueData	current;	/* @ */
+	bool			lax;		/* unwrap arrays automatically */
+} PathExecContextData, *PathExecContext;
+
+/*
+ * Evaluator. Each function calls execute_next for every value it yields.
+ * When found is NULL, only existence matters and evaluation stops at the
+ * first value.
+ */
+static bool execute_item(PathExecContext cxt, JsonPathItem *jsp,
+		const PathValue value, List **found);
+static bool execute_next(PathExecContext cxt, JsonPathItem *jsp,
+		const PathValue value, List **found);
+static bool execute_unwrap_array(PathExecContext cxt, JsonPathItem *jsp,
+		const PathValue value, const ScanMsgpackHeader array, List **found);
+static bool execute_any(PathExecContext cxt, JsonPathItem *jsp,
+		const PathValue value, uint32 level, List **found);
+static bool execute_index_array(PathExecContext cxt, JsonPathItem *jsp,
+		const PathValue value, const ScanMsgpackHeader array, List **found);
+static PathBool execute_bool(PathExecContext cxt, JsonPathItem *jsp);
+static PathBool execute_comparison(PathExecContext cxt, JsonPathItem *jsp);
+static PathBool execute_starts_with(PathExecContext cxt, JsonPathItem *jsp);
+
+/*
+ * Utility functions
+ */
+static List * execute_path(Datum data, JsonPath *path, bool exists_only, bool *exists);
+static Datum match_path(FunctionCallInfo fcinfo, bool silent);
+static List * execute_operand(PathExecContext cxt, JsonPathItem *jsp);
+static PathBool compare_values(JsonPathItemType op, const PathValue a, const PathValue b);
+static int compare_numbers(const ScanMsgpackHeader a, const ScanMsgpackHeader b);
+static int32 get_subscript(JsonPathItem *jsp, uint32 size);
+static PathValue make_literal(JsonPathItem *jsp);
+static PathValue make_bool(PathBool b);
+static PathValue pack_to_value(msgpack_sbuffer *sbuf);
+
+
+Datum
+msgpack_path_exists(PG_FUNCTION_ARGS)
+{
+	JsonPath	*path = PG_GETARG_JSONPATH_P(1);
+	bool		exists;
+
+	execute_path(PG_GETARG_DATUM(0), path, true, &exists);
+
+	PG_RETURN_BOOL(exists);
+}
+
+Datum
+msgpack_path_match(PG_FUNCTION_ARGS)
+{
+	return match_path(fcinfo, PG_GETARG_BOOL(2));
+}
+
+/*
+ * Implementation of the @@ operator, which returns NULL instead of raising
+ * an error when the predicate does not yield a single boolean, as jsonb does
+ */
+Datum
+msgpack_path_match_opr(PG_FUNCTION_ARGS)
+{
+	return match_path(fcinfo, true);
+}
+
+/*
+ * The evaluator is recursive and cannot be suspended, so all results are
+ * collected on the first call and returned one by one afterwards. Results
+ * are only byte ranges into the detoasted document, so the extra memory is
+ * a list cell and two pointers per result; the values themselves are copied
+ * out one call at a time.
+ */
+Datum
+msgpack_path_query(PG_FUNCTION_ARGS)
+{
+	FuncCallContext	*funcctx;
+	List			*found;
+	PathValue		value;
+
+	if (SRF_IS_FIRSTCALL()) {
+		MemoryContext	oldcontext;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		/* found values point into the document, so it must survive calls */
+		found = execute_path(PG_GETARG_DATUM(0), PG_GETARG_JSONPATH_P_COPY(1),
+				false, NULL);
+		funcctx->user_fctx = found;
+		funcctx->max_calls = list_length(found);
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	found = (List *) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls) {
+		value = (PathValue) list_nth(found, funcctx->call_cntr);
+
+		SRF_RETURN_NEXT(funcctx,
+				PointerGetDatum(scan_msgpack_to_bytea(value->start, value->end)));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * Evaluator
+ */
+static bool
+execute_item(PathExecContext cxt, JsonPathItem *jsp, const PathValue value, List **found)
+{
+	ScanMsgpackHeaderData	header;
+	PathValueData			child;
+	JsonPathItem			arg;
+	PathValueData			saved;
+	PathBool				b;
+	const char				*p;
+	char					*key;
+	int32					keylen;
+	uint32					i;
+	bool					res = false;
+
+	switch (jsp->type) {
+		case jpiRoot:
+			return execute_next(cxt, jsp, &cxt->root, found);
+
+		case jpiCurrent:
+			return execute_next(cxt, jsp, &cxt->current, found);
+
+		case jpiNull:
+		case jpiBool:
+		case jpiNumeric:
+		case jpiString:
+			return execute_next(cxt, jsp, make_literal(jsp), found);
+
+		case jpiKey:
+			if (!scan_msgpack_header(value->start, value->end, &header))
+				return false;
+
+			if (header.type == SCAN_MSGPACK_ARRAY && cxt->lax)
+				return execute_unwrap_array(cxt, jsp, value, &header, found);
+
+			key = jspGetString(jsp, &keylen);
+			if (!scan_msgpack_map_lookup(value->start, value->end, key, keylen,
+						&child.start, &child.end))
+				return false;
+
+			return execute_next(cxt, jsp, &child, found);
+
+		case jpiAnyKey:
+			if (!scan_msgpack_header(value->start, value->end, &header))
+				return false;
+
+			if (header.type == SCAN_MSGPACK_ARRAY && cxt->lax)
+				return execute_unwrap_array(cxt, jsp, value, &header, found);
+
+			if (header.type != SCAN_MSGPACK_MAP)
+				return false;
+
+			p = header.body;
+			for (i = 0; i < header.size; ++i) {
+				/* skip the key */
+				if ((child.start = scan_msgpack_skip(p, value->end)) == NULL)
+					return res;
+				if ((child.end = scan_msgpack_skip(child.start, value->end)) == NULL)
+					return res;
+				p = child.end;
+
+				if (execute_next(cxt, jsp, &child, found)) {
+					res = true;
+					if (found == NULL)
+						return true;
+				}
+			}
+			return res;
+
+		case jpiAnyArray:
+			if (!scan_msgpack_header(value->start, value->end, &header))
+				return false;
+
+			if (header.type == SCAN_MSGPACK_ARRAY) {
+				p = header.body;
+				for (i = 0; i < header.size; ++i) {
+					child.start = p;
+					if ((child.end = scan_msgpack_skip(p, value->end)) == NULL)
+						return res;
+					p = child.end;
+
+					if (execute_next(cxt, jsp, &child, found)) {
+						res = true;
+						if (found == NULL)
+							return true;
+					}
+				}
+				return res;
+			}
+
+			/* in lax mode, a non-array is an array of itself */
+			if (cxt->lax)
+				return execute_next(cxt, jsp, value, found);
+			return false;
+
+		case jpiIndexArray:
+			if (!scan_msgpack_header(value->start, value->end, &header))
+				return false;
+
+			if (header.type != SCAN_MSGPACK_ARRAY) {
+				if (!cxt->lax)
+					return false;
+				/* treat the value as an array of itself */
+				header.type = SCAN_MSGPACK_ARRAY;
+				header.size = 1;
+				header.body = value->start;
+			}
+			return execute_index_array(cxt, jsp, value, &header, found);
+
+		case jpiAny:
+			return execute_any(cxt, jsp, value, 0, found);
+
+		case jpiFilter:
+			if (!scan_msgpack_header(value->start, value->end, &header))
+				return false;
+
+			if (header.type == SCAN_MSGPACK_ARRAY && cxt->lax)
+				return execute_unwrap_array(cxt, jsp, value, &header, found);
+
+			jspGetArg(jsp, &arg);
+
+			saved = cxt->current;
+			cxt->current = *value;
+			b = execute_bool(cxt, &arg);
+			cxt->current = saved;
+
+			if (b != PATH_BOOL_TRUE)
+				return false;
+			return execute_next(cxt, jsp, value, found);
+
+		case jpiAnd:
+		case jpiOr:
+		case jpiNot:
+		case jpiIsUnknown:
+		case jpiEqual:
+		case jpiNotEqual:
+		case jpiLess:
+		case jpiGreater:
+		case jpiLessOrEqual:
+		case jpiGreaterOrEqual:
+		case jpiExists:
+		case jpiStartsWith:
+			/* a predicate at the top level yields true, false or null */
+			return execute_next(cxt, jsp, make_bool(execute_bool(cxt, jsp)), found);
+
+		default:
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("jsonpath item of type %d is not supported for msgpack",
+						 jsp->type)));
+	}
+
+	return false;
+}
+
+static bool
+execute_next(PathExecContext cxt, JsonPathItem *jsp, const PathValue value, List **found)
+{
+	JsonPathItem	next;
+	PathValue		copy;
+
+	if (jspGetNext(jsp, &next))
+		return execute_item(cxt, &next, value, found);
+
+	if (found != NULL) {
+		copy = palloc(sizeof(PathValueData));
+		*copy = *value;
+		*found = lappend(*found, copy);
+	}
+	return true;
+}
+
+static bool
+execute_unwrap_array(PathExecContext cxt, JsonPathItem *jsp,
+		const PathValue value, const ScanMsgpackHeader array, List **found)
+{
+	PathValueData	element;
+	const char		*p = array->body;
+	const char		*end = value->end;
+	uint32			i;
+	bool			res = false;
+
+	/* apply the same item to each element */
+	for (i = 0; i < array->size; ++i) {
+		element.start = p;
+		if ((element.end = scan_msgpack_skip(p, end)) == NULL)
+			return res;
+		p = element.end;
+
+		if (execute_item(cxt, jsp, &element, found)) {
+			res = true;
+			if (found == NULL)
+				return true;
+		}
+	}
+	return res;
+}
+
+static bool
+execute_any(PathExecContext cxt, JsonPathItem *jsp, const PathValue value,
+		uint32 level, List **found)
+{
+	ScanMsgpackHeaderData	header;
+	PathValueData			child;
+	const char				*p;
+	uint32					i;
+	bool					res = false;
+
+	check_stack_depth();
+
+	if (level >= jsp->content.anybounds.first) {
+		if (execute_next(cxt, jsp, value, found)) {
+			res = true;
+			if (found == NULL)
+				return true;
+		}
+	}
+
+	if (level >= jsp->content.anybounds.last)
+		return res;
+
+	if (!scan_msgpack_header(value->start, value->end, &header))
+		return res;
+
+	if (header.type != SCAN_MSGPACK_ARRAY && header.type != SCAN_MSGPACK_MAP)
+		return res;
+
+	p = header.body;
+	for (i = 0; i < header.size; ++i) {
+		/* descend into values only, not into keys */
+		if (header.type == SCAN_MSGPACK_MAP &&
+				(p = scan_msgpack_skip(p, value->end)) == NULL)
+			return res;
+
+		child.start = p;
+		if ((child.end = scan_msgpack_skip(p, value->end)) == NULL)
+			return res;
+		p = child.end;
+
+		if (execute_any(cxt, jsp, &child, level + 1, found)) {
+			res = true;
+			if (found == NULL)
+				return true;
+		}
+	}
+	return res;
+}
+
+static bool
+execute_index_array(PathExecContext cxt, JsonPathItem *jsp, const PathValue value,
+		const ScanMsgpackHeader array, List **found)
+{
+	JsonPathItem	from;
+	JsonPathItem	to;
+	PathValueData	element;
+	const char		*p;
+	int32			index_from;
+	int32			index_to;
+	int32			index;
+	int				i;
+	bool			res = false;
+
+	for (i = 0; i < jsp->content.array.nelems; ++i) {
+		if (jspGetArraySubscript(jsp, &from, &to, i)) {
+			index_from = get_subscript(&from, array->size);
+			index_to = get_subscript(&to, array->size);
+		} else
+			index_from = index_to = get_subscript(&from, array->size);
+
+		if (index_from < 0)
+			index_from = 0;
+		if (index_to >= (int32) array->size)
+			index_to = (int32) array->size - 1;
+
+		/* out of range subscripts select nothing, but later ones still apply */
+		if (index_from > index_to)
+			continue;
+
+		/* elements are variable length, so walk up to the first one */
+		p = array->body;
+		for (index = 0; index < index_from; ++index) {
+			if ((p = scan_msgpack_skip(p, value->end)) == NULL)
+				return res;
+		}
+
+		for (; index <= index_to; ++index) {
+			element.start = p;
+			if ((element.end = scan_msgpack_skip(p, value->end)) == NULL)
+				return res;
+			p = element.end;
+
+			if (execute_next(cxt, jsp, &element, found)) {
+				res = true;
+				if (found == NULL)
+					return true;
+			}
+		}
+	}
+	return res;
+}
+
+static PathBool
+execute_bool(PathExecContext cxt, JsonPathItem *jsp)
+{
+	JsonPathItem	larg;
+	JsonPathItem	rarg;
+	PathBool		lres;
+	PathBool		rres;
+
+	check_stack_depth();
+
+	switch (jsp->type) {
+		case jpiAnd:
+			jspGetLeftArg(jsp, &larg);
+			lres = execute_bool(cxt, &larg);
+			if (lres == PATH_BOOL_FALSE)
+				return PATH_BOOL_FALSE;
+
+			jspGetRightArg(jsp, &rarg);
+			rres = execute_bool(cxt, &rarg);
+			return rres == PATH_BOOL_TRUE ? lres : rres;
+
+		case jpiOr:
+			jspGetLeftArg(jsp, &larg);
+			lres = execute_bool(cxt, &larg);
+			if (lres == PATH_BOOL_TRUE)
+				return PATH_BOOL_TRUE;
+
+			jspGetRightArg(jsp, &rarg);
+			rres = execute_bool(cxt, &rarg);
+			return rres == PATH_BOOL_FALSE ? lres : rres;
+
+		case jpiNot:
+			jspGetArg(jsp, &larg);
+			lres = execute_bool(cxt, &larg);
+			if (lres == PATH_BOOL_UNKNOWN)
+				return PATH_BOOL_UNKNOWN;
+			return lres == PATH_BOOL_TRUE ? PATH_BOOL_FALSE : PATH_BOOL_TRUE;
+
+		case jpiIsUnknown:
+			jspGetArg(jsp, &larg);
+			lres = execute_bool(cxt, &larg);
+			return lres == PATH_BOOL_UNKNOWN ? PATH_BOOL_TRUE : PATH_BOOL_FALSE;
+
+		case jpiEqual:
+		case jpiNotEqual:
+		case jpiLess:
+		case jpiGreater:
+		case jpiLessOrEqual:
+		case jpiGreaterOrEqual:
+			return execute_comparison(cxt, jsp);
+
+		case jpiStartsWith:
+			return execute_starts_with(cxt, jsp);
+
+		case jpiExists:
+			jspGetArg(jsp, &larg);
+			return execute_item(cxt, &larg, &cxt->current, NULL) ?
+				PATH_BOOL_TRUE : PATH_BOOL_FALSE;
+
+		default:
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("jsonpath predicate of type %d is not supported for msgpack",
+						 jsp->type)));
+	}
+
+	return PATH_BOOL_UNKNOWN;
+}
+
+static PathBool
+execute_comparison(PathExecContext cxt, JsonPathItem *jsp)
+{
+	JsonPathItem	larg;
+	JsonPathItem	rarg;
+	List			*lfound;
+	List			*rfound;
+	ListCell		*lc;
+	ListCell		*rc;
+	bool			unknown = false;
+
+	jspGetLeftArg(jsp, &larg);
+	jspGetRightArg(jsp, &rarg);
+
+	lfound = execute_operand(cxt, &larg);
+	rfound = execute_operand(cxt, &rarg);
+
+	/* true if any pair of the operand sequences compares true */
+	foreach(lc, lfound) {
+		foreach(rc, rfound) {
+			switch (compare_values(jsp->type, lfirst(lc), lfirst(rc))) {
+				case PATH_BOOL_TRUE:
+					return PATH_BOOL_TRUE;
+				case PATH_BOOL_UNKNOWN:
+					unknown = true;
+					break;
+				case PATH_BOOL_FALSE:
+					break;
+			}
+		}
+	}
+
+	return unknown ? PATH_BOOL_UNKNOWN : PATH_BOOL_FALSE;
+}
+
+static PathBool
+execute_starts_with(PathExecContext cxt, JsonPathItem *jsp)
+{
+	JsonPathItem			larg;
+	JsonPathItem			rarg;
+	List					*lfound;
+	List					*rfound;
+	ListCell				*lc;
+	PathValue				prefix;
+	ScanMsgpackHeaderData	lh;
+	ScanMsgpackHeaderData	rh;
+	bool					unknown = false;
+
+	jspGetLeftArg(jsp, &larg);
+	jspGetRightArg(jsp, &rarg);
+
+	lfound = execute_operand(cxt, &larg);
+	rfound = execute_operand(cxt, &rarg);
+
+	if (list_length(rfound) != 1)
+		return PATH_BOOL_UNKNOWN;
+
+	prefix = (PathValue) linitial(rfound);
+	if (!scan_msgpack_header(prefix->start, prefix->end, &rh) ||
+			rh.type != SCAN_MSGPACK_RAW)
+		return PATH_BOOL_UNKNOWN;
+
+	foreach(lc, lfound) {
+		PathValue value = (PathValue) lfirst(lc);
+
+		if (!scan_msgpack_header(value->start, value->end, &lh) ||
+				lh.type != SCAN_MSGPACK_RAW) {
+			unknown = true;
+			continue;
+		}
+
+		if (lh.size >= rh.size && memcmp(lh.body, rh.body, rh.size) == 0)
+			return PATH_BOOL_TRUE;
+	}
+
+	return unknown ? PATH_BOOL_UNKNOWN : PATH_BOOL_FALSE;
+}
+
+/*
+ * Utility functions
+ */
+static List *
+execute_path(Datum data, JsonPath *path, bool exists_only, bool *exists)
+{
+	bytea				*doc = DatumGetByteaP(data);
+	PathExecContextData	cxt;
+	JsonPathItem		jsp;
+	List				*found = NIL;
+	bool				res;
+
+	cxt.root.start = VARDATA(doc);
+	cxt.root.end = cxt.root.start + VARSIZE(doc) - VARHDRSZ;
+	cxt.current = cxt.root;
+	/* strict mode only disables unwrapping; structural errors stay silent */
+	cxt.lax = (path->header & JSONPATH_LAX) != 0;
+
+	jspInit(&jsp, path);
+
+	res = execute_item(&cxt, &jsp, &cxt.root, exists_only ? NULL : &found);
+
+	if (exists != NULL)
+		*exists = res;
+
+	return found;
+}
+
+static Datum
+match_path(FunctionCallInfo fcinfo, bool silent)
+{
+	JsonPath				*path = PG_GETARG_JSONPATH_P(1);
+	List					*found;
+	PathValue				value;
+	ScanMsgpackHeaderData	header;
+
+	found = execute_path(PG_GETARG_DATUM(0), path, false, NULL);
+
+	if (list_length(found) == 1) {
+		value = (PathValue) linitial(found);
+
+		if (scan_msgpack_header(value->start, value->end, &header)) {
+			if (header.type == SCAN_MSGPACK_BOOLEAN)
+				PG_RETURN_BOOL(header.via.boolean);
+			if (header.type == SCAN_MSGPACK_NIL)
+				PG_RETURN_NULL();
+		}
+	}
+
+	if (!silent)
+		ereport(ERROR,
+				(errcode(ERRCODE_SINGLETON_SQL_JSON_ITEM_REQUIRED),
+				 errmsg("single boolean result is expected")));
+	PG_RETURN_NULL();
+}
+
+static List *
+execute_operand(PathExecContext cxt, JsonPathItem *jsp)
+{
+	List	*found = NIL;
+
+	execute_item(cxt, jsp, &cxt->current, &found);
+
+	return found;
+}
+
+static PathBool
+compare_values(JsonPathItemType op, const PathValue a, const PathValue b)
+{
+	ScanMsgpackHeaderData	ha;
+	ScanMsgpackHeaderData	hb;
+	int						cmp;
+
+	if (!scan_msgpack_header(a->start, a->end, &ha) ||
+			!scan_msgpack_header(b->start, b->end, &hb))
+		return PATH_BOOL_UNKNOWN;
+
+	if (ha.type == SCAN_MSGPACK_NIL || hb.type == SCAN_MSGPACK_NIL) {
+		/* null only equals null, and is never ordered against others */
+		if (ha.type != hb.type)
+			return op == jpiNotEqual ? PATH_BOOL_TRUE : PATH_BOOL_FALSE;
+		cmp = 0;
+	} else if (ha.type == SCAN_MSGPACK_BOOLEAN && hb.type == SCAN_MSGPACK_BOOLEAN) {
+		cmp = ha.via.boolean == hb.via.boolean ? 0 : (ha.via.boolean ? 1 : -1);
+	} else if (ha.type == SCAN_MSGPACK_RAW && hb.type == SCAN_MSGPACK_RAW) {
+		cmp = memcmp(ha.body, hb.body, Min(ha.size, hb.size));
+		if (cmp == 0)
+			cmp = ha.size == hb.size ? 0 : (ha.size < hb.size ? -1 : 1);
+	} else if (ha.type >= SCAN_MSGPACK_POSITIVE_INTEGER && ha.type <= SCAN_MSGPACK_DOUBLE &&
+			hb.type >= SCAN_MSGPACK_POSITIVE_INTEGER && hb.type <= SCAN_MSGPACK_DOUBLE) {
+		cmp = compare_numbers(&ha, &hb);
+	} else
+		return PATH_BOOL_UNKNOWN;
+
+	switch (op) {
+		case jpiEqual:
+			return cmp == 0 ? PATH_BOOL_TRUE : PATH_BOOL_FALSE;
+		case jpiNotEqual:
+			return cmp != 0 ? PATH_BOOL_TRUE : PATH_BOOL_FALSE;
+		case jpiLess:
+			return cmp < 0 ? PATH_BOOL_TRUE : PATH_BOOL_FALSE;
+		case jpiGreater:
+			return cmp > 0 ? PATH_BOOL_TRUE : PATH_BOOL_FALSE;
+		case jpiLessOrEqual:
+			return cmp <= 0 ? PATH_BOOL_TRUE : PATH_BOOL_FALSE;
+		case jpiGreaterOrEqual:
+			return cmp >= 0 ? PATH_BOOL_TRUE : PATH_BOOL_FALSE;
+		default:
+			elog(ERROR, "unrecognized jsonpath comparison: %d", op);
+	}
+
+	return PATH_BOOL_UNKNOWN;
+}
+
+static int
+compare_numbers(const ScanMsgpackHeader a, const ScanMsgpackHeader b)
+{
+	double	da;
+	double	db;
+
+	/* integers are compared exactly */
+	if (a->type == SCAN_MSGPACK_POSITIVE_INTEGER && b->type == SCAN_MSGPACK_POSITIVE_INTEGER)
+		return a->via.u64 == b->via.u64 ? 0 : (a->via.u64 < b->via.u64 ? -1 : 1);
+	if (a->type == SCAN_MSGPACK_NEGATIVE_INTEGER && b->type == SCAN_MSGPACK_NEGATIVE_INTEGER)
+		return a->via.i64 == b->via.i64 ? 0 : (a->via.i64 < b->via.i64 ? -1 : 1);
+	if (a->type == SCAN_MSGPACK_NEGATIVE_INTEGER && b->type == SCAN_MSGPACK_POSITIVE_INTEGER)
+		return -1;
+	if (a->type == SCAN_MSGPACK_POSITIVE_INTEGER && b->type == SCAN_MSGPACK_NEGATIVE_INTEGER)
+		return 1;
+
+	da = a->type == SCAN_MSGPACK_POSITIVE_INTEGER ? (double) a->via.u64 :
+		a->type == SCAN_MSGPACK_NEGATIVE_INTEGER ? (double) a->via.i64 : a->via.dec;
+	db = b->type == SCAN_MSGPACK_POSITIVE_INTEGER ? (double) b->via.u64 :
+		b->type == SCAN_MSGPACK_NEGATIVE_INTEGER ? (double) b->via.i64 : b->via.dec;
+
+	/* NaN sorts above everything, as in numeric */
+	if (isnan(da))
+		return isnan(db) ? 0 : 1;
+	if (isnan(db))
+		return -1;
+
+	return da == db ? 0 : (da < db ? -1 : 1);
+}
+
+static int32
+get_subscript(JsonPathItem *jsp, uint32 size)
+{
+	if (jsp->type == jpiLast)
+		return (int32) size - 1;
+
+	if (jsp->type != jpiNumeric)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("only numeric literals and last are supported as jsonpath subscripts for msgpack")));
+
+	/* subscripts are truncated, not rounded, as for jsonb */
+	return DatumGetInt32(DirectFunctionCall1(numeric_int4,
+				DirectFunctionCall2(numeric_trunc,
+					NumericGetDatum(jspGetNumeric(jsp)), Int32GetDatum(0))));
+}
+
+static PathValue
+make_literal(JsonPathItem *jsp)
+{
+	msgpack_sbuffer	sbuf;
+	msgpack_packer	pk;
+	char			*str;
+	int32			len;
+	double			d;
+
+	msgpack_sbuffer_init(&sbuf);
+	msgpack_packer_init(&pk, &sbuf, msgpack_sbuffer_write);
+
+	switch (jsp->type) {
+		case jpiNull:
+			msgpack_pack_nil(&pk);
+			break;
+		case jpiBool:
+			if (jspGetBool(jsp))
+				msgpack_pack_true(&pk);
+			else
+				msgpack_pack_false(&pk);
+			break;
+		case jpiNumeric:
+			d = DatumGetFloat8(DirectFunctionCall1(numeric_float8,
+						NumericGetDatum(jspGetNumeric(jsp))));
+			/* pack integral numbers as integers, the same as msgpack_in does */
+			if (d == floor(d) && d >= -9223372036854775808.0 && d < 9223372036854775808.0) {
+				if (d < 0)
+					msgpack_pack_int64(&pk, (int64) d);
+				else
+					msgpack_pack_uint64(&pk, (uint64) d);
+			} else
+				msgpack_pack_double(&pk, d);
+			break;
+		case jpiString:
+			str = jspGetString(jsp, &len);
+			msgpack_pack_raw(&pk, len);
+			msgpack_pack_raw_body(&pk, str, len);
+			break;
+		default:
+			elog(ERROR, "unexpected jsonpath literal type: %d", jsp->type);
+	}
+
+	return pack_to_value(&sbuf);
+}
+
+static PathValue
+make_bool(PathBool b)
+{
+	msgpack_sbuffer	sbuf;
+	msgpack_packer	pk;
+
+	msgpack_sbuffer_init(&sbuf);
+	msgpack_packer_init(&pk, &sbuf, msgpack_sbuffer_write);
+
+	switch (b) {
+		case PATH_BOOL_TRUE:
+			msgpack_pack_true(&pk);
+			break;
+		case PATH_BOOL_FALSE:
+			msgpack_pack_false(&pk);
+			break;
+		case PATH_BOOL_UNKNOWN:
+			msgpack_pack_nil(&pk);
+			break;
+	}
+
+	return pack_to_value(&sbuf);
+}
+
+static PathValue
+pack_to_value(msgpack_sbuffer *sbuf)
+{
+	PathValue	value = palloc(sizeof(PathValueData));
+	char		*data = palloc(sbuf->size);
+
+	memcpy(data, sbuf->data, sbuf->size);
+	value->start = data;
+	value->end = data + sbuf->size;
+
+	msgpack_sbuffer_destroy(sbuf);
+
+	return value;
+}
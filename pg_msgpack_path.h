@@ -0,0 +1,11 @@
+#ifndef __PG_MSGPACK_PATH_H__
+#define __PG_MSGPACK_PATH_H__
+
+#include "fmgr.h"
+
+Datum msgpack_path_exists(PG_FUNCTION_ARGS);
+Datum msgpack_path_match(PG_FUNCTION_ARGS);
+Datum msgpack_path_match_opr(PG_FUNCTION_ARGS);
+Datum msgpack_path_query(PG_FUNCTION_ARGS);
+
+#endif /* __PG_MSGPACK_PATH_H__ */
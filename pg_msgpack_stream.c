@@ -0,0 +1,118 @@
+#include "postgres.h"
+#include "funcapi.h"
+#include "mb/pg_wchar.h"
+#include "miscadmin.h"
+
+#include "pg_msgpack_stream.h"
+#include "scan_msgpack.h"
+
+PG_FUNCTION_INFO_V1(msgpack_stream_split);
+
+/*
+ * State of a split across calls
+ */
+typedef struct {
+	const char	*start;
+	const char	*p;
+	const char	*end;
+	bool		validate;
+} StreamSplitData, *StreamSplit;
+
+/*
+ * private functions
+ */
+static const char * validate_value(const char *p, const char *end);
+
+
+Datum
+msgpack_stream_split(PG_FUNCTION_ARGS)
+{
+	FuncCallContext	*funcctx;
+	StreamSplit		split;
+	const char		*start;
+	const char		*next;
+
+	if (SRF_IS_FIRSTCALL()) {
+		MemoryContext	oldcontext;
+		bytea			*data;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		/* values are cut out of the stream one call at a time */
+		data = PG_GETARG_BYTEA_P(0);
+		split = palloc(sizeof(StreamSplitData));
+		split->start = VARDATA(data);
+		split->p = split->start;
+		split->end = split->start + VARSIZE(data) - VARHDRSZ;
+		split->validate = PG_GETARG_BOOL(1);
+		funcctx->user_fctx = split;
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	split = (StreamSplit) funcctx->user_fctx;
+
+	if (split->p < split->end) {
+		if (split->validate)
+			next = validate_value(split->p, split->end);
+		else
+			next = scan_msgpack_skip(split->p, split->end);
+
+		if (next == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid or truncated msgpack value at offset %d",
+						 (int) (split->p - split->start))));
+
+		start = split->p;
+		split->p = next;
+
+		SRF_RETURN_NEXT(funcctx,
+				PointerGetDatum(scan_msgpack_to_bytea(start, next)));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * private functions
+ */
+
+/*
+ * Walk every nested value and check that strings are valid in the server
+ * encoding. Returns the first byte after the value, or NULL if invalid.
+ */
+static const char *
+validate_value(const char *p, const char *end)
+{
+	ScanMsgpackHeaderData	header;
+	uint64					n;
+	uint64					i;
+
+	check_stack_depth();
+
+	if (!scan_msgpack_header(p, end, &header))
+		return NULL;
+
+	switch (header.type) {
+		case SCAN_MSGPACK_RAW:
+			if (!pg_verifymbstr(header.body, header.size, true))
+				return NULL;
+			return header.body + header.size;
+
+		case SCAN_MSGPACK_ARRAY:
+		case SCAN_MSGPACK_MAP:
+			n = header.type == SCAN_MSGPACK_MAP ? (uint64) header.size * 2 : header.size;
+			p = header.body;
+			for (i = 0; i < n; ++i) {
+				if ((p = validate_value(p, end)) == NULL)
+					return NULL;
+			}
+			return p;
+
+		default:
+			return scan_msgpack_skip(p, end);
+	}
+}
@@ -0,0 +1,8 @@
+#ifndef __PG_MSGPACK_STREAM_H__
+#define __PG_MSGPACK_STREAM_H__
+
+#include "fmgr.h"
+
+Datum msgpack_stream_split(PG_FUNCTION_ARGS);
+
+#endif /* __PG_MSGPACK_STREAM_H__ */
@@ -0,0 +1,358 @@
+#include "postgres.h"
+#include "commands/defrem.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "tsearch/ts_cache.h"
+#include "tsearch/ts_type.h"
+#include "tsearch/ts_utils.h"
+#include "utils/builtins.h"
+#include "utils/jsonb.h"
+#if PG_VERSION_NUM >= 130000
+#include "utils/jsonfuncs.h"
+#else
+#include "utils/jsonapi.h"
+#endif
+
+#include "pg_msgpack_tsearch.h"
+#include "scan_msgpack.h"
+
+PG_FUNCTION_INFO_V1(msgpack_to_tsvector);
+PG_FUNCTION_INFO_V1(msgpack_to_tsvector_byid);
+PG_FUNCTION_INFO_V1(msgpack_string_to_tsvector);
+PG_FUNCTION_INFO_V1(msgpack_string_to_tsvector_byid);
+PG_FUNCTION_INFO_V1(msgpack_ts_headline);
+PG_FUNCTION_INFO_V1(msgpack_ts_headline_opt);
+PG_FUNCTION_INFO_V1(msgpack_ts_headline_byid);
+PG_FUNCTION_INFO_V1(msgpack_ts_headline_byid_opt);
+
+/*
+ * State for to_tsvector
+ */
+typedef struct {
+	ParsedText	*prs;
+	Oid			cfgId;
+	uint32		flags;
+} TSVectorBuildStateData, *TSVectorBuildState;
+
+/*
+ * State for ts_headline
+ */
+typedef struct {
+	HeadlineParsedText	*prs;
+	TSConfigCacheEntry	*cfg;
+	TSParserCacheEntry	*prsobj;
+	TSQuery				query;
+	List				*prsoptions;
+	StringInfo			out;
+} HeadlineStateData, *HeadlineState;
+
+/*
+ * private functions
+ */
+static TSVector msgpack_to_tsvector_worker(Oid cfgId, bytea *data, uint32 flags);
+static const char * add_value_to_tsvector(TSVectorBuildState state, const char *p,
+		const char *end);
+static void add_to_tsvector(TSVectorBuildState state, const char *str, int len);
+static const char * headline_value(HeadlineState state, const char *p, const char *end);
+
+
+Datum
+msgpack_string_to_tsvector(PG_FUNCTION_ARGS)
+{
+	bytea	*data = PG_GETARG_BYTEA_P(0);
+	Oid		cfgId = getTSCurrentConfig(true);
+
+	PG_RETURN_TSVECTOR(msgpack_to_tsvector_worker(cfgId, data, jtiString));
+}
+
+Datum
+msgpack_string_to_tsvector_byid(PG_FUNCTION_ARGS)
+{
+	Oid		cfgId = PG_GETARG_OID(0);
+	bytea	*data = PG_GETARG_BYTEA_P(1);
+
+	PG_RETURN_TSVECTOR(msgpack_to_tsvector_worker(cfgId, data, jtiString));
+}
+
+Datum
+msgpack_to_tsvector(PG_FUNCTION_ARGS)
+{
+	bytea	*data = PG_GETARG_BYTEA_P(0);
+	Jsonb	*filter = PG_GETARG_JSONB_P(1);
+	Oid		cfgId = getTSCurrentConfig(true);
+
+	/* the filter is the same as for jsonb, e.g. '["string", "key"]' */
+	PG_RETURN_TSVECTOR(msgpack_to_tsvector_worker(cfgId, data,
+				parse_jsonb_index_flags(filter)));
+}
+
+Datum
+msgpack_to_tsvector_byid(PG_FUNCTION_ARGS)
+{
+	Oid		cfgId = PG_GETARG_OID(0);
+	bytea	*data = PG_GETARG_BYTEA_P(1);
+	Jsonb	*filter = PG_GETARG_JSONB_P(2);
+
+	PG_RETURN_TSVECTOR(msgpack_to_tsvector_worker(cfgId, data,
+				parse_jsonb_index_flags(filter)));
+}
+
+Datum
+msgpack_ts_headline_byid_opt(PG_FUNCTION_ARGS)
+{
+	Oid					tsconfig = PG_GETARG_OID(0);
+	bytea				*data = PG_GETARG_BYTEA_P(1);
+	TSQuery				query = PG_GETARG_TSQUERY(2);
+	text				*opt = (PG_NARGS() > 3 && PG_GETARG_POINTER(3)) ? PG_GETARG_TEXT_P(3) : NULL;
+	const char			*start = VARDATA(data);
+	const char			*end = start + VARSIZE(data) - VARHDRSZ;
+	HeadlineParsedText	prs;
+	HeadlineStateData	state;
+	StringInfoData		out;
+
+	memset(&prs, 0, sizeof(HeadlineParsedText));
+	prs.lenwords = 32;
+	prs.words = (HeadlineWordEntry *) palloc(sizeof(HeadlineWordEntry) * prs.lenwords);
+
+	initStringInfo(&out);
+	appendStringInfoSpaces(&out, VARHDRSZ);
+
+	state.prs = &prs;
+	state.cfg = lookup_ts_config_cache(tsconfig);
+	state.prsobj = lookup_ts_parser_cache(state.cfg->prsId);
+	state.query = query;
+	state.prsoptions = opt ? deserialize_deflist(PointerGetDatum(opt)) : NIL;
+	state.out = &out;
+
+	if (!OidIsValid(state.prsobj->headlineOid))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("text search parser does not support headline creation")));
+
+	/* the document is copied with every string value replaced by its headline */
+	if (headline_value(&state, start, end) != end)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid msgpack value")));
+
+	SET_VARSIZE(out.data, out.len);
+
+	PG_FREE_IF_COPY(data, 1);
+	PG_FREE_IF_COPY(query, 2);
+
+	PG_RETURN_BYTEA_P((bytea *) out.data);
+}
+
+Datum
+msgpack_ts_headline_byid(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_DATUM(DirectFunctionCall3(msgpack_ts_headline_byid_opt,
+				PG_GETARG_DATUM(0),
+				PG_GETARG_DATUM(1),
+				PG_GETARG_DATUM(2)));
+}
+
+Datum
+msgpack_ts_headline(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_DATUM(DirectFunctionCall3(msgpack_ts_headline_byid_opt,
+				ObjectIdGetDatum(getTSCurrentConfig(true)),
+				PG_GETARG_DATUM(0),
+				PG_GETARG_DATUM(1)));
+}
+
+Datum
+msgpack_ts_headline_opt(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_DATUM(DirectFunctionCall4(msgpack_ts_headline_byid_opt,
+				ObjectIdGetDatum(getTSCurrentConfig(true)),
+				PG_GETARG_DATUM(0),
+				PG_GETARG_DATUM(1),
+				PG_GETARG_DATUM(2)));
+}
+
+/*
+ * private functions
+ */
+static TSVector
+msgpack_to_tsvector_worker(Oid cfgId, bytea *data, uint32 flags)
+{
+	TSVectorBuildStateData	state;
+	ParsedText				prs;
+	const char				*start = VARDATA(data);
+	const char				*end = start + VARSIZE(data) - VARHDRSZ;
+
+	prs.lenwords = 16;
+	prs.words = (ParsedWord *) palloc(sizeof(ParsedWord) * prs.lenwords);
+	prs.curwords = 0;
+	prs.pos = 0;
+
+	state.prs = &prs;
+	state.cfgId = cfgId;
+	state.flags = flags;
+
+	if (add_value_to_tsvector(&state, start, end) != end)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid msgpack value")));
+
+	return make_tsvector(&prs);
+}
+
+/*
+ * Feed the strings of the value at p, and its keys, numbers and booleans when
+ * the flags ask for them, to the parser. Returns the first byte after the
+ * value.
+ */
+static const char *
+add_value_to_tsvector(TSVectorBuildState state, const char *p, const char *end)
+{
+	ScanMsgpackHeaderData	header;
+	ScanMsgpackHeaderData	key;
+	char					*str;
+	uint32					i;
+
+	check_stack_depth();
+
+	if (!scan_msgpack_header(p, end, &header))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid msgpack value")));
+
+	switch (header.type) {
+		case SCAN_MSGPACK_RAW:
+			/* payloads go to the parser in place */
+			if (state->flags & jtiString)
+				add_to_tsvector(state, header.body, header.size);
+			return header.body + header.size;
+
+		case SCAN_MSGPACK_POSITIVE_INTEGER:
+		case SCAN_MSGPACK_NEGATIVE_INTEGER:
+		case SCAN_MSGPACK_FLOAT:
+		case SCAN_MSGPACK_DOUBLE:
+			if (state->flags & jtiNumeric) {
+				if (header.type == SCAN_MSGPACK_POSITIVE_INTEGER)
+					str = psprintf(UINT64_FORMAT, header.via.u64);
+				else if (header.type == SCAN_MSGPACK_NEGATIVE_INTEGER)
+					str = psprintf(INT64_FORMAT, header.via.i64);
+				else if (header.type == SCAN_MSGPACK_FLOAT)
+					str = DatumGetCString(DirectFunctionCall1(float4out,
+								Float4GetDatum((float4) header.via.dec)));
+				else
+					str = DatumGetCString(DirectFunctionCall1(float8out,
+								Float8GetDatum(header.via.dec)));
+				add_to_tsvector(state, str, strlen(str));
+				pfree(str);
+			}
+			return scan_msgpack_skip_or_error(p, end);
+
+		case SCAN_MSGPACK_BOOLEAN:
+			if (state->flags & jtiBool) {
+				if (header.via.boolean)
+					add_to_tsvector(state, "true", 4);
+				else
+					add_to_tsvector(state, "false", 5);
+			}
+			return header.body;
+
+		case SCAN_MSGPACK_ARRAY:
+			p = header.body;
+			for (i = 0; i < header.size; ++i)
+				p = add_value_to_tsvector(state, p, end);
+			return p;
+
+		case SCAN_MSGPACK_MAP:
+			p = header.body;
+			for (i = 0; i < header.size; ++i) {
+				if (!scan_msgpack_header(p, end, &key))
+					ereport(ERROR,
+							(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+							 errmsg("invalid msgpack value")));
+
+				if ((state->flags & jtiKey) && key.type == SCAN_MSGPACK_RAW)
+					add_to_tsvector(state, key.body, key.size);
+
+				p = add_value_to_tsvector(state, scan_msgpack_skip_or_error(p, end), end);
+			}
+			return p;
+
+		default:
+			return scan_msgpack_skip_or_error(p, end);
+	}
+}
+
+static void
+add_to_tsvector(TSVectorBuildState state, const char *str, int len)
+{
+	ParsedText	*prs = state->prs;
+	int32		prevwords = prs->curwords;
+
+	parsetext(state->cfgId, prs, (char *) str, len);
+
+	/*
+	 * Leave a gap after each value that produced words, so that phrase
+	 * searches do not match across values, as for jsonb.
+	 */
+	if (prs->curwords > prevwords)
+		prs->pos += 1;
+}
+
+/*
+ * Append the value at p to the output with its string values headlined.
+ * Keys and everything else are copied as they are. Returns the first byte
+ * after the value.
+ */
+static const char *
+headline_value(HeadlineState state, const char *p, const char *end)
+{
+	ScanMsgpackHeaderData	header;
+	const char				*next;
+	text					*headline;
+	uint32					i;
+
+	check_stack_depth();
+
+	if (!scan_msgpack_header(p, end, &header))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid msgpack value")));
+
+	switch (header.type) {
+		case SCAN_MSGPACK_RAW:
+			state->prs->curwords = 0;
+			hlparsetext(state->cfg->cfgId, state->prs, state->query,
+					(char *) header.body, header.size);
+			FunctionCall3(&(state->prsobj->prsheadline),
+					PointerGetDatum(state->prs),
+					PointerGetDatum(state->prsoptions),
+					PointerGetDatum(state->query));
+
+			headline = generateHeadline(state->prs);
+			scan_msgpack_append_header(state->out, SCAN_MSGPACK_RAW,
+					VARSIZE(headline) - VARHDRSZ);
+			appendBinaryStringInfo(state->out, VARDATA(headline),
+					VARSIZE(headline) - VARHDRSZ);
+			pfree(headline);
+			return header.body + header.size;
+
+		case SCAN_MSGPACK_ARRAY:
+		case SCAN_MSGPACK_MAP:
+			/* the number of elements does not change */
+			appendBinaryStringInfo(state->out, header.start, header.body - header.start);
+			p = header.body;
+			for (i = 0; i < header.size; ++i) {
+				if (header.type == SCAN_MSGPACK_MAP) {
+					next = scan_msgpack_skip_or_error(p, end);
+					appendBinaryStringInfo(state->out, p, next - p);
+					p = next;
+				}
+				p = headline_value(state, p, end);
+			}
+			return p;
+
+		default:
+			next = scan_msgpack_skip_or_error(p, end);
+			appendBinaryStringInfo(state->out, p, next - p);
+			return next;
+	}
+}
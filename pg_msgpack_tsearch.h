@@ -0,0 +1,15 @@
+#ifndef __PG_MSGPACK_TSEARCH_H__
+#define __PG_MSGPACK_TSEARCH_H__
+
+#include "fmgr.h"
+
+Datum msgpack_to_tsvector(PG_FUNCTION_ARGS);
+Datum msgpack_to_tsvector_byid(PG_FUNCTION_ARGS);
+Datum msgpack_string_to_tsvector(PG_FUNCTION_ARGS);
+Datum msgpack_string_to_tsvector_byid(PG_FUNCTION_ARGS);
+Datum msgpack_ts_headline(PG_FUNCTION_ARGS);
+Datum msgpack_ts_headline_opt(PG_FUNCTION_ARGS);
+Datum msgpack_ts_headline_byid(PG_FUNCTION_ARGS);
+Datum msgpack_ts_headline_byid_opt(PG_FUNCTION_ARGS);
+
+#endif /* __PG_MSGPACK_TSEARCH_H__ */
@@ -0,0 +1,525 @@
+#include "postgres.h"
+
+#include "scan_msgpack.h"
+
+/*
+ * private functions
+ */
+static inline uint16 load_be16(const unsigned char *p);
+static inline uint32 load_be32(const unsigned char *p);
+static inline uint64 load_be64(const unsigned char *p);
+static inline char * store_be(char *p, uint64 v, int nbytes);
+
+
+bool
+scan_msgpack_header(const char *p, const char *end, ScanMsgpackHeader header)
+{
+	const unsigned char	*u = (const unsigned char *) p;
+	unsigned char		c;
+	size_t				avail;
+	uint32				f32;
+	uint64				f64;
+
+	if (p >= end)
+		return false;
+
+	avail = end - p;
+	c = u[0];
+
+	header->start = p;
+	header->size = 0;
+
+	/* fixed formats */
+	if (c <= 0x7f) {
+		header->type = SCAN_MSGPACK_POSITIVE_INTEGER;
+		header->via.u64 = c;
+		header->body = p + 1;
+		return true;
+	}
+	if (c <= 0x8f) {
+		header->type = SCAN_MSGPACK_MAP;
+		header->size = c & 0x0f;
+		header->body = p + 1;
+		return true;
+	}
+	if (c <= 0x9f) {
+		header->type = SCAN_MSGPACK_ARRAY;
+		header->size = c & 0x0f;
+		header->body = p + 1;
+		return true;
+	}
+	if (c <= 0xbf) {
+		header->type = SCAN_MSGPACK_RAW;
+		header->size = c & 0x1f;
+		header->body = p + 1;
+		goto check_payload;
+	}
+	if (c >= 0xe0) {
+		header->type = SCAN_MSGPACK_NEGATIVE_INTEGER;
+		header->via.i64 = (int8) c;
+		header->body = p + 1;
+		return true;
+	}
+
+	switch (c) {
+		case 0xc0:
+			header->type = SCAN_MSGPACK_NIL;
+			header->body = p + 1;
+			return true;
+
+		case 0xc2:
+		case 0xc3:
+			header->type = SCAN_MSGPACK_BOOLEAN;
+			header->via.boolean = (c == 0xc3);
+			header->body = p + 1;
+			return true;
+
+		/* bin 8/16/32 */
+		case 0xc4:
+			if (avail < 2)
+				return false;
+			header->type = SCAN_MSGPACK_BIN;
+			header->size = u[1];
+			header->body = p + 2;
+			goto check_payload;
+		case 0xc5:
+			if (avail < 3)
+				return false;
+			header->type = SCAN_MSGPACK_BIN;
+			header->size = load_be16(u + 1);
+			header->body = p + 3;
+			goto check_payload;
+		case 0xc6:
+			if (avail < 5)
+				return false;
+			header->type = SCAN_MSGPACK_BIN;
+			header->size = load_be32(u + 1);
+			header->body = p + 5;
+			goto check_payload;
+
+		/* ext 8/16/32 */
+		case 0xc7:
+			if (avail < 3)
+				return false;
+			header->type = SCAN_MSGPACK_EXT;
+			header->size = u[1];
+			header->via.ext_type = (int8) u[2];
+			header->body = p + 3;
+			goto check_payload;
+		case 0xc8:
+			if (avail < 4)
+				return false;
+			header->type = SCAN_MSGPACK_EXT;
+			header->size = load_be16(u + 1);
+			header->via.ext_type = (int8) u[3];
+			header->body = p + 4;
+			goto check_payload;
+		case 0xc9:
+			if (avail < 6)
+				return false;
+			header->type = SCAN_MSGPACK_EXT;
+			header->size = load_be32(u + 1);
+			header->via.ext_type = (int8) u[5];
+			header->body = p + 6;
+			goto check_payload;
+
+		case 0xca:
+			if (avail < 5)
+				return false;
+			header->type = SCAN_MSGPACK_FLOAT;
+			f32 = load_be32(u + 1);
+			{
+				float	f;
+				memcpy(&f, &f32, sizeof(f));
+				header->via.dec = f;
+			}
+			header->body = p + 5;
+			return true;
+		case 0xcb:
+			if (avail < 9)
+				return false;
+			header->type = SCAN_MSGPACK_DOUBLE;
+			f64 = load_be64(u + 1);
+			memcpy(&header->via.dec, &f64, sizeof(double));
+			header->body = p + 9;
+			return true;
+
+		/* uint 8/16/32/64 */
+		case 0xcc:
+			if (avail < 2)
+				return false;
+			header->type = SCAN_MSGPACK_POSITIVE_INTEGER;
+			header->via.u64 = u[1];
+			header->body = p + 2;
+			return true;
+		case 0xcd:
+			if (avail < 3)
+				return false;
+			header->type = SCAN_MSGPACK_POSITIVE_INTEGER;
+			header->via.u64 = load_be16(u + 1);
+			header->body = p + 3;
+			return true;
+		case 0xce:
+			if (avail < 5)
+				return false;
+			header->type = SCAN_MSGPACK_POSITIVE_INTEGER;
+			header->via.u64 = load_be32(u + 1);
+			header->body = p + 5;
+			return true;
+		case 0xcf:
+			if (avail < 9)
+				return false;
+			header->type = SCAN_MSGPACK_POSITIVE_INTEGER;
+			header->via.u64 = load_be64(u + 1);
+			header->body = p + 9;
+			return true;
+
+		/* int 8/16/32/64 */
+		case 0xd0:
+			if (avail < 2)
+				return false;
+			header->type = SCAN_MSGPACK_NEGATIVE_INTEGER;
+			header->via.i64 = (int8) u[1];
+			header->body = p + 2;
+			break;
+		case 0xd1:
+			if (avail < 3)
+				return false;
+			header->type = SCAN_MSGPACK_NEGATIVE_INTEGER;
+			header->via.i64 = (int16) load_be16(u + 1);
+			header->body = p + 3;
+			break;
+		case 0xd2:
+			if (avail < 5)
+				return false;
+			header->type = SCAN_MSGPACK_NEGATIVE_INTEGER;
+			header->via.i64 = (int32) load_be32(u + 1);
+			header->body = p + 5;
+			break;
+		case 0xd3:
+			if (avail < 9)
+				return false;
+			header->type = SCAN_MSGPACK_NEGATIVE_INTEGER;
+			header->via.i64 = (int64) load_be64(u + 1);
+			header->body = p + 9;
+			break;
+
+		/* fixext 1/2/4/8/16 */
+		case 0xd4:
+		case 0xd5:
+		case 0xd6:
+		case 0xd7:
+		case 0xd8:
+			if (avail < 2)
+				return false;
+			header->type = SCAN_MSGPACK_EXT;
+			header->size = 1 << (c - 0xd4);
+			header->via.ext_type = (int8) u[1];
+			header->body = p + 2;
+			goto check_payload;
+
+		/* str 8, raw 16/32 */
+		case 0xd9:
+			if (avail < 2)
+				return false;
+			header->type = SCAN_MSGPACK_RAW;
+			header->size = u[1];
+			header->body = p + 2;
+			goto check_payload;
+		case 0xda:
+			if (avail < 3)
+				return false;
+			header->type = SCAN_MSGPACK_RAW;
+			header->size = load_be16(u + 1);
+			header->body = p + 3;
+			goto check_payload;
+		case 0xdb:
+			if (avail < 5)
+				return false;
+			header->type = SCAN_MSGPACK_RAW;
+			header->size = load_be32(u + 1);
+			header->body = p + 5;
+			goto check_payload;
+
+		/* array 16/32 */
+		case 0xdc:
+			if (avail < 3)
+				return false;
+			header->type = SCAN_MSGPACK_ARRAY;
+			header->size = load_be16(u + 1);
+			header->body = p + 3;
+			return true;
+		case 0xdd:
+			if (avail < 5)
+				return false;
+			header->type = SCAN_MSGPACK_ARRAY;
+			header->size = load_be32(u + 1);
+			header->body = p + 5;
+			return true;
+
+		/* map 16/32 */
+		case 0xde:
+			if (avail < 3)
+				return false;
+			header->type = SCAN_MSGPACK_MAP;
+			header->size = load_be16(u + 1);
+			header->body = p + 3;
+			return true;
+		case 0xdf:
+			if (avail < 5)
+				return false;
+			header->type = SCAN_MSGPACK_MAP;
+			header->size = load_be32(u + 1);
+			header->body = p + 5;
+			return true;
+
+		default:
+			/* 0xc1 is never used */
+			return false;
+	}
+
+	/* signed integer formats may still hold a non-negative value */
+	if (header->via.i64 >= 0) {
+		header->type = SCAN_MSGPACK_POSITIVE_INTEGER;
+		header->via.u64 = (uint64) header->via.i64;
+	}
+	return true;
+
+check_payload:
+	return (size_t) (end - header->body) >= header->size;
+}
+
+const char *
+scan_msgpack_skip(const char *p, const char *end)
+{
+	ScanMsgpackHeaderData	header;
+	uint64					pending = 1;
+
+	/* walk iteratively so that deep nesting cannot exhaust the stack */
+	while (pending > 0) {
+		if (!scan_msgpack_header(p, end, &header))
+			return NULL;
+
+		pending -= 1;
+
+		switch (header.type) {
+			case SCAN_MSGPACK_RAW:
+			case SCAN_MSGPACK_BIN:
+			case SCAN_MSGPACK_EXT:
+				p = header.body + header.size;
+				break;
+			case SCAN_MSGPACK_ARRAY:
+				pending += header.size;
+				p = header.body;
+				break;
+			case SCAN_MSGPACK_MAP:
+				pending += (uint64) header.size * 2;
+				p = header.body;
+				break;
+			default:
+				p = header.body;
+				break;
+		}
+	}
+
+	return p;
+}
+
+bool
+scan_msgpack_map_lookup(const char *p, const char *end,
+		const char *key, uint32 keylen,
+		const char **val_start, const char **val_end)
+{
+	ScanMsgpackHeaderData	map;
+	ScanMsgpackHeaderData	k;
+	const char				*v;
+	uint32					i;
+
+	if (!scan_msgpack_header(p, end, &map) || map.type != SCAN_MSGPACK_MAP)
+		return false;
+
+	p = map.body;
+	for (i = 0; i < map.size; ++i) {
+		if (!scan_msgpack_header(p, end, &k))
+			return false;
+
+		/* skip the key */
+		if (k.type == SCAN_MSGPACK_RAW)
+			v = k.body + k.size;
+		else if ((v = scan_msgpack_skip(p, end)) == NULL)
+			return false;
+
+		/* skip the value */
+		if ((p = scan_msgpack_skip(v, end)) == NULL)
+			return false;
+
+		if (k.type == SCAN_MSGPACK_RAW && k.size == keylen &&
+				memcmp(k.body, key, keylen) == 0) {
+			*val_start = v;
+			*val_end = p;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bytea *
+scan_msgpack_to_bytea(const char *start, const char *end)
+{
+	bytea	*out;
+	size_t	size = end - start;
+
+	out = (bytea *) palloc(size + VARHDRSZ);
+	SET_VARSIZE(out, size + VARHDRSZ);
+	memcpy(VARDATA(out), start, size);
+
+	return out;
+}
+
+const char *
+scan_msgpack_skip_or_error(const char *p, const char *end)
+{
+	const char *next = scan_msgpack_skip(p, end);
+
+	if (next == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid msgpack value")));
+
+	return next;
+}
+
+int
+scan_msgpack_raw_cmp(const char *a, uint32 alen, const char *b, uint32 blen)
+{
+	int cmp = memcmp(a, b, Min(alen, blen));
+
+	if (cmp != 0)
+		return cmp;
+
+	return alen == blen ? 0 : (alen < blen ? -1 : 1);
+}
+
+char *
+scan_msgpack_write_header(char *p, ScanMsgpackType type, uint32 n)
+{
+	switch (type) {
+		case SCAN_MSGPACK_RAW:
+			/* raw is written as in the old spec, without str8 */
+			if (n < 32) {
+				*p++ = (char) (0xa0 | n);
+				return p;
+			}
+			*p++ = (char) (n < 65536 ? 0xda : 0xdb);
+			break;
+
+		case SCAN_MSGPACK_BIN:
+			if (n < 256) {
+				*p++ = (char) 0xc4;
+				return store_be(p, n, 1);
+			}
+			*p++ = (char) (n < 65536 ? 0xc5 : 0xc6);
+			break;
+
+		case SCAN_MSGPACK_ARRAY:
+		case SCAN_MSGPACK_MAP:
+			if (n < 16) {
+				*p++ = (char) ((type == SCAN_MSGPACK_MAP ? 0x80 : 0x90) | n);
+				return p;
+			}
+			if (type == SCAN_MSGPACK_MAP)
+				*p++ = (char) (n < 65536 ? 0xde : 0xdf);
+			else
+				*p++ = (char) (n < 65536 ? 0xdc : 0xdd);
+			break;
+
+		default:
+			elog(ERROR, "unexpected msgpack type %d", (int) type);
+	}
+
+	return store_be(p, n, n < 65536 ? 2 : 4);
+}
+
+char *
+scan_msgpack_write_ext_header(char *p, int8 ext_type, uint32 size)
+{
+	switch (size) {
+		case 1:
+			*p++ = (char) 0xd4;
+			break;
+		case 2:
+			*p++ = (char) 0xd5;
+			break;
+		case 4:
+			*p++ = (char) 0xd6;
+			break;
+		case 8:
+			*p++ = (char) 0xd7;
+			break;
+		case 16:
+			*p++ = (char) 0xd8;
+			break;
+
+		default:
+			if (size < 256) {
+				*p++ = (char) 0xc7;
+				p = store_be(p, size, 1);
+			} else if (size < 65536) {
+				*p++ = (char) 0xc8;
+				p = store_be(p, size, 2);
+			} else {
+				*p++ = (char) 0xc9;
+				p = store_be(p, size, 4);
+			}
+			break;
+	}
+
+	*p++ = (char) ext_type;
+
+	return p;
+}
+
+void
+scan_msgpack_append_header(StringInfo out, ScanMsgpackType type, uint32 n)
+{
+	char	header[SCAN_MSGPACK_MAX_HEADER_SIZE];
+
+	appendBinaryStringInfo(out, header,
+			scan_msgpack_write_header(header, type, n) - header);
+}
+
+/*
+ * private functions
+ */
+static inline uint16
+load_be16(const unsigned char *p)
+{
+	return ((uint16) p[0] << 8) | p[1];
+}
+
+static inline uint32
+load_be32(const unsigned char *p)
+{
+	return ((uint32) p[0] << 24) | ((uint32) p[1] << 16) |
+		((uint32) p[2] << 8) | p[3];
+}
+
+static inline uint64
+load_be64(const unsigned char *p)
+{
+	return ((uint64) load_be32(p) << 32) | load_be32(p + 4);
+}
+
+static inline char *
+store_be(char *p, uint64 v, int nbytes)
+{
+	int i;
+
+	for (i = nbytes - 1; i >= 0; --i) {
+		p[i] = (char) (v & 0xff);
+		v >>= 8;
+	}
+
+	return p + nbytes;
+}
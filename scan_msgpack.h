@@ -0,0 +1,89 @@
+#ifndef __SCAN_MSGPACK_H__
+#define __SCAN_MSGPACK_H__
+
+#include "postgres.h"
+#include "lib/stringinfo.h"
+
+/*
+ * Byte-level scanner over encoded msgpack.
+ *
+ * Unlike msgpack_unpack_next, nothing is decoded into a zone: the scanner
+ * reads one header at a time and skips over payloads by their length, so
+ * callers can look at a value in place and copy its byte range verbatim.
+ * The writers below produce the narrowest headers, as msgpack_in does.
+ */
+
+/* Longest header the writers produce */
+#define SCAN_MSGPACK_MAX_HEADER_SIZE 6
+
+typedef enum {
+	SCAN_MSGPACK_NIL,
+	SCAN_MSGPACK_BOOLEAN,
+	SCAN_MSGPACK_POSITIVE_INTEGER,
+	SCAN_MSGPACK_NEGATIVE_INTEGER,
+	SCAN_MSGPACK_FLOAT,
+	SCAN_MSGPACK_DOUBLE,
+	SCAN_MSGPACK_RAW,
+	SCAN_MSGPACK_BIN,
+	SCAN_MSGPACK_EXT,
+	SCAN_MSGPACK_ARRAY,
+	SCAN_MSGPACK_MAP
+} ScanMsgpackType;
+
+typedef struct {
+	ScanMsgpackType	type;
+	/* first byte of the value */
+	const char		*start;
+	/* first byte after the header */
+	const char		*body;
+	/*
+	 * payload length for raw, bin and ext;
+	 * number of elements for array and number of pairs for map
+	 */
+	uint32			size;
+	union {
+		bool	boolean;
+		uint64	u64;
+		int64	i64;
+		double	dec;
+		int8	ext_type;
+	} via;
+} ScanMsgpackHeaderData, *ScanMsgpackHeader;
+
+/* Read the header of the value at p. Returns false if malformed or truncated */
+bool scan_msgpack_header(const char *p, const char *end, ScanMsgpackHeader header);
+
+/* Return the first byte after the value at p, or NULL if malformed or truncated */
+const char * scan_msgpack_skip(const char *p, const char *end);
+
+/* Same as above, but raise an error if malformed or truncated */
+const char * scan_msgpack_skip_or_error(const char *p, const char *end);
+
+/*
+ * Look up a raw key in the map at p. On success, set the byte range of the
+ * value of the first matching entry. Returns false if p is not a map or the
+ * key is not found.
+ */
+bool scan_msgpack_map_lookup(const char *p, const char *end,
+		const char *key, uint32 keylen,
+		const char **val_start, const char **val_end);
+
+/* Copy the byte range of a value into a new bytea */
+bytea * scan_msgpack_to_bytea(const char *start, const char *end);
+
+/* Order raw payloads bytewise, shorter first on a common prefix */
+int scan_msgpack_raw_cmp(const char *a, uint32 alen, const char *b, uint32 blen);
+
+/*
+ * Write the narrowest header of a raw, bin, array or map of n bytes or
+ * elements at p. Returns the first byte after the header.
+ */
+char * scan_msgpack_write_header(char *p, ScanMsgpackType type, uint32 n);
+
+/* Same as above for an ext of the given type and payload length */
+char * scan_msgpack_write_ext_header(char *p, int8 ext_type, uint32 size);
+
+/* Append the narrowest header of a raw, bin, array or map of n items */
+void scan_msgpack_append_header(StringInfo out, ScanMsgpackType type, uint32 n);
+
+#endif /* __SCAN_MSGPACK_H__ */
@@ -2,7 +2,150 @@ CREATE EXTENSION pg_msgpack;
 
 -- conversion
 SELECT '[null, true, false, 10, 5.500000, {"a":"b"}]'::msgpack;
+SELECT '[1e2, -1, -129, 18446744073709551615, 18446744073709551616, 0.1]'::msgpack::bytea;
+SELECT '"\u00e9\ud83d\ude00\"x"'::msgpack::bytea;
+SELECT '{"a":[[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15], {}], "b":[]}'::msgpack;
+SELECT '{"a" 1}'::msgpack;
+SELECT '[1, 2'::msgpack;
 
 -- operator
 SELECT '{"a":"b"}'::msgpack -> 'a';
 SELECT '[1,2,3]'::msgpack -> 1;
+
+-- comparison
+SELECT '{"tenant":42}'::msgpack -> 'tenant' = '42'::msgpack;
+SELECT '{"tenant":42}'::msgpack -> 'tenant' <> '43'::msgpack;
+SELECT '[1,2,3]'::msgpack -> 0 < '[1,2,3]'::msgpack -> 2;
+
+-- key existence
+SELECT '{"a":1,"b":2}'::msgpack ? 'b';
+SELECT '{"a":1,"b":2}'::msgpack ? 'c';
+SELECT '[1,2,3]'::msgpack ? 'a';
+
+-- statistics
+CREATE TABLE msgpack_stats (doc msgpack);
+INSERT INTO msgpack_stats VALUES
+	('{"a":1,"b":2,"c":3}'), ('{"a":1,"b":2}'), ('{"a":1}'), (NULL);
+ANALYZE msgpack_stats;
+SELECT most_common_elems FROM pg_stats
+	WHERE tablename = 'msgpack_stats' AND attname = 'doc';
+DROP TABLE msgpack_stats;
+CREATE TABLE msgpack_kv (doc msgpack);
+INSERT INTO msgpack_kv SELECT format('{"k":%s}', CASE WHEN i <= 90 THEN 1 ELSE i END)::json::msgpack
+	FROM generate_series(1, 100) i;
+ANALYZE msgpack_kv;
+CREATE FUNCTION msgpack_plan_rows(query text) RETURNS text AS $$
+DECLARE
+	plan json;
+BEGIN
+	EXECUTE 'EXPLAIN (FORMAT JSON) ' || query INTO plan;
+	RETURN plan -> 0 -> 'Plan' ->> 'Plan Rows';
+END
+$$ LANGUAGE plpgsql;
+SELECT msgpack_plan_rows($$SELECT * FROM msgpack_kv WHERE doc -> 'k' = '1'$$);
+SELECT msgpack_plan_rows($$SELECT * FROM msgpack_kv WHERE doc -> 'k' = '95'$$);
+DROP FUNCTION msgpack_plan_rows(text);
+DROP TABLE msgpack_kv;
+
+-- jsonpath
+SELECT '{"a":[1,2,3]}'::msgpack @? '$.a[*] ? (@ > 2)';
+SELECT '{"a":[1,2,3]}'::msgpack @? '$.a[*] ? (@ > 3)';
+SELECT '{"a":{"b":"x"}}'::msgpack @@ '$.a.b == "x"';
+SELECT '{"a":1}'::msgpack @@ '$.a';
+SELECT msgpack_path_match('{"a":1}', '$.a');
+SELECT msgpack_path_query('{"a":[{"b":1},{"b":"x"},{"c":2}]}', '$.a.b');
+SELECT msgpack_path_query('[0,1,2,3]', '$[1 to last]');
+SELECT msgpack_path_query('[1,2,3]', '$[10, 0]');
+SELECT msgpack_path_query('[0,1,2,3]', '$[1.7]');
+
+-- canonical encoding
+SELECT msgpack_canonicalize('{"b":1, "a":{"d":2, "c":3}, "b":4}');
+SELECT msgpack_canonicalize('{"x":1, "y":2}') = msgpack_canonicalize('{"y":2, "x":1}');
+SELECT msgpack_canonicalize('[1.5, 0.1]')::bytea;
+SELECT msgpack_canonicalize('[1.5, 0.1]', true)::bytea;
+SELECT msgpack_canonicalize('\x8201a161cc01a162'::bytea::msgpack)::bytea;
+SELECT msgpack_canonicalize('\x92c5000161c800010561'::bytea::msgpack)::bytea;
+CREATE TABLE msgpack_docs (doc msgpack);
+CREATE INDEX ON msgpack_docs (msgpack_canonicalize(doc -> 'tenant'));
+INSERT INTO msgpack_docs VALUES ('{"tenant":42}'), ('\x81a674656e616e74cc2a'::bytea::msgpack);
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+SELECT count(*) FROM msgpack_docs WHERE doc -> 'tenant' = '42';
+EXPLAIN (COSTS OFF) SELECT count(*) FROM msgpack_docs
+	WHERE msgpack_canonicalize(doc -> 'tenant') = msgpack_canonicalize('42');
+SELECT count(*) FROM msgpack_docs
+	WHERE msgpack_canonicalize(doc -> 'tenant') = msgpack_canonicalize('42');
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+DROP TABLE msgpack_docs;
+
+-- foreign data wrapper
+\getenv abs_builddir PG_ABS_BUILDDIR
+\set msgpack_file :abs_builddir '/results/pg_msgpack_fdw.msgpack'
+-- {"id":1, "name":"a", "extra":[1,2]} followed by {"name":"b", "id":2}
+\! printf '\203\242id\001\244name\241a\245extra\222\001\002\202\244name\241b\242id\002' > "$PG_ABS_BUILDDIR/results/pg_msgpack_fdw.msgpack"
+CREATE SERVER msgpack_files FOREIGN DATA WRAPPER msgpack_fdw;
+CREATE FOREIGN TABLE msgpack_events (
+	id integer,
+	label text OPTIONS (key 'name'),
+	extra msgpack
+) SERVER msgpack_files OPTIONS (filename :'msgpack_file');
+SELECT * FROM msgpack_events;
+SELECT label FROM msgpack_events WHERE extra = '[1,2]';
+DROP FOREIGN TABLE msgpack_events;
+DROP SERVER msgpack_files;
+\! rm "$PG_ABS_BUILDDIR/results/pg_msgpack_fdw.msgpack"
+
+-- expanded maps
+SELECT msgpack_set('{"a":1, "b":2}', 'a', '"x"');
+SELECT msgpack_set(msgpack_set('{}', 'a', '1'), 'b', '[true]');
+SELECT msgpack_set('[1]', 'a', '1');
+CREATE FUNCTION msgpack_build(n integer) RETURNS msgpack AS $$
+DECLARE
+	doc msgpack := '{}';
+BEGIN
+	FOR i IN 1..n LOOP
+		doc := msgpack_set(doc, 'k' || i, to_json(i)::msgpack);
+	END LOOP;
+	RETURN doc;
+END
+$$ LANGUAGE plpgsql;
+SELECT msgpack_build(3);
+SELECT msgpack_build(20) -> 'k17', msgpack_build(20) ? 'k21';
+DROP FUNCTION msgpack_build(integer);
+
+-- key extraction
+SELECT msgpack_extract_keys('{"a":1, "b":[2], "c":"x", "a":4}', '{c,a,z}');
+SELECT msgpack_extract_keys('{"a":1}', '{}');
+SELECT msgpack_extract_values('{"a":1, "b":[2], "c":"x"}', '{c,z,a,c}');
+SELECT msgpack_extract_values('[1, 2]', '{a}');
+
+-- stream splitting
+SELECT * FROM msgpack_stream_split('\x01a161920203'::bytea);
+SELECT count(*) FROM msgpack_stream_split(''::bytea);
+SELECT * FROM msgpack_stream_split('\x01a26162c0'::bytea, true);
+SELECT * FROM msgpack_stream_split('\x0192a2ff'::bytea);
+SELECT * FROM msgpack_stream_split('\x0192a10000'::bytea, true);
+
+-- full text search
+SELECT to_tsvector('simple', '{"a":"The quick fox", "b":[1, "jumps"]}'::msgpack);
+SELECT to_tsvector('simple', '{"a":"The quick fox", "b":[1, "jumps"]}'::msgpack, '["key", "numeric"]');
+SELECT to_tsvector('simple', '["The quick fox", "jumps"]'::msgpack) @@ 'quick <-> fox',
+	to_tsvector('simple', '["The quick fox", "jumps"]'::msgpack) @@ 'fox <-> jumps';
+SELECT ts_headline('simple', '{"a":"The quick fox", "b":[1, "lazy fox"]}'::msgpack, 'fox');
+SELECT ts_headline('simple', '{"fox":"fox"}'::msgpack, 'fox', 'StartSel=[, StopSel=]');
+
+-- deltas
+SELECT msgpack_diff('{"a":1, "b":{"c":2, "d":[1]}, "e":"x"}', '{"a":1, "b":{"c":3, "d":[1]}, "e":"x"}');
+SELECT msgpack_diff('{"a":1, "b":2}', '{"b":2, "c":[true]}');
+SELECT msgpack_diff('[1]', '[2]');
+SELECT msgpack_diff('\xde0003a16101a16202a16303'::bytea::msgpack, '{"a":1, "b":5, "c":3}');
+SELECT msgpack_patch(o, msgpack_diff(o, n))::bytea = n::bytea FROM (VALUES
+	('\xde0003a16101a16202a16303'::bytea::msgpack, '{"a":1, "b":5, "c":3}'::msgpack),
+	('{"a":1}', '\x82a16101d90162ff'::bytea::msgpack)) AS docs(o, n);
+SELECT msgpack_patch('{"a":1, "b":2}', msgpack_diff('{"a":1, "b":2}', '{"b":2, "c":[true]}'));
+SELECT msgpack_patch('[1]', '[[["a"], 1]]');
+SELECT msgpack_patch_agg(v ORDER BY n) FROM (VALUES
+	(1, '{"name":"a", "size":1}'::msgpack),
+	(2, msgpack_diff('{"name":"a", "size":1}', '{"name":"a", "size":2}')),
+	(3, msgpack_diff('{"name":"a", "size":2}', '{"name":"b", "size":2}'))) AS versions(n, v);
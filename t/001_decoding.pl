@@ -0,0 +1,36 @@
+# Logical decoding of changes on a table with a msgpack column
+use strict;
+use warnings;
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More tests => 1;
+
+my $node = PostgreSQL::Test::Cluster->new('main');
+$node->init(allows_streaming => 'logical');
+$node->start;
+
+$node->safe_psql('postgres', q{
+	CREATE EXTENSION pg_msgpack;
+	CREATE TABLE msgpack_changes (id integer PRIMARY KEY, doc msgpack);
+	SELECT pg_create_logical_replication_slot('msgpack_slot', 'pg_msgpack');
+});
+
+$node->safe_psql('postgres', q{
+	INSERT INTO msgpack_changes VALUES (1, '{"a":1}');
+	UPDATE msgpack_changes SET doc = '{"a":[1,2]}' WHERE id = 1;
+	DELETE FROM msgpack_changes WHERE id = 1;
+});
+
+# begin and commit records carry xids and lsns, which vary between runs
+my $result = $node->safe_psql('postgres', q{
+	SELECT data::msgpack
+	FROM pg_logical_slot_get_binary_changes('msgpack_slot', NULL, NULL)
+	WHERE data::msgpack::json ->> 'op' NOT IN ('B', 'C');
+});
+
+is($result, q({"op":"I", "relation":"public.msgpack_changes", "new":{"id":1, "doc":{"a":1}}}
+{"op":"U", "relation":"public.msgpack_changes", "new":{"id":1, "doc":{"a":[1, 2]}}}
+{"op":"D", "relation":"public.msgpack_changes", "old":{"id":1}}),
+	'inserts, updates and deletes are decoded into msgpack maps');
+
+$node->stop;